@@ -0,0 +1,143 @@
+/* arp.c
+   Arpeggiator on the live input.
+
+   While a mode is set, note messages from the input are not recorded or
+   passed thru but held here. The held notes are kept twice, sorted by
+   pitch and in the order they were played, so every mode picks its next
+   note by index: a position counter runs over the held notes times the
+   octave range, and up, down and up-down map it straight to an index.
+   Picking a note takes the same time however many notes are held; only
+   note on and off shift the arrays.
+
+   The main loop asks arp_due on every pass with the clock ticks into the
+   pattern, so the notes fall on the step grid, and plays what arp_next
+   gives it. The receive interrupt changes the held notes, so arp_next is
+   called with interrupts disabled. */
+
+#include "arp.h"
+#include "midi.h"
+#include "rng.h"
+
+struct arp_note {
+	unsigned char note;
+	unsigned char velocity;
+};
+
+int arp_mode = ARP_OFF;
+
+static int octave_range = 1;
+static int rate = CLOCKS_PER_STEP;						// Clock ticks between notes
+static struct arp_note sorted[ARP_NOTES];			// Held notes, lowest first
+static struct arp_note played[ARP_NOTES];			// Held notes, oldest first
+static int held = 0;
+static unsigned char channel = 0;							// Of the last note on
+static unsigned int position = 0;
+static unsigned int last_slot = 0;
+
+void arp_set_mode(int mode) {
+	arp_mode = (mode > ARP_PLAYED) ? ARP_PLAYED : mode;
+	if (arp_mode == ARP_OFF) {
+		held = 0;
+	}
+	position = 0;
+}
+
+void arp_set_octaves(int octaves) {
+	octave_range = (octaves < 1) ? 1 : (octaves > 4 ? 4 : octaves);
+}
+
+void arp_set_rate(int ticks) {
+	rate = (ticks < 1) ? 1 : ticks;
+}
+
+// Takes note out of list, returns 1 if it was there
+static int remove_note(struct arp_note *list, unsigned char note) {
+	int i;
+	for (i = 0; i < held && list[i].note != note; i++);
+	if (i == held) {
+		return 0;
+	}
+	for (; i < held - 1; i++) {
+		list[i] = list[i + 1];
+	}
+	return 1;
+}
+
+// A note on or, with velocity 0, a note off from the input
+void arp_note(unsigned char ch, unsigned char note, unsigned char velocity) {
+	int i;
+	if (remove_note(played, note)) {
+		remove_note(sorted, note);
+		held--;
+	}
+	if (!velocity) {
+		return;
+	}
+	if (held == ARP_NOTES) {								// Drop the oldest
+		remove_note(sorted, played[0].note);
+		remove_note(played, played[0].note);
+		held--;
+	}
+	for (i = held; i > 0 && sorted[i - 1].note > note; i--) {
+		sorted[i] = sorted[i - 1];
+	}
+	sorted[i].note = note;
+	sorted[i].velocity = velocity;
+	played[held] = sorted[i];
+	held++;
+	channel = ch;
+}
+
+// Returns 1 when ticks, counted from the start of the pattern, enters a new note
+int arp_due(unsigned int ticks) {
+	unsigned int slot = ticks / rate;
+	if (slot == last_slot) {
+		return 0;
+	}
+	last_slot = slot;
+	return 1;
+}
+
+/*
+	Sets msg to the next note, with a duration of half the rate, and
+	returns 1, or returns 0 when no notes are held
+*/
+int arp_next(struct message *msg) {
+	int cycle = held * octave_range;
+	int pos, period;
+	struct arp_note n;
+
+	if (arp_mode == ARP_OFF || held == 0) {
+		return 0;
+	}
+	switch (arp_mode) {
+		case ARP_DOWN:
+			pos = cycle - 1 - position % cycle;
+			break;
+		case ARP_UP_DOWN:											// Ends are not repeated
+			period = (cycle > 1) ? 2 * cycle - 2 : 1;
+			pos = position % period;
+			if (pos >= cycle) {
+				pos = period - pos;
+			}
+			break;
+		case ARP_RANDOM:
+			pos = rng_next() % cycle;
+			break;
+		default:
+			pos = position % cycle;
+	}
+	position++;
+
+	n = (arp_mode == ARP_PLAYED) ? played[pos % held] : sorted[pos % held];
+	int note = n.note + 12 * (pos / held);
+	while (note > 127) {
+		note -= 12;
+	}
+	msg->command = 0x90 | channel;
+	msg->note = note;
+	msg->velocity = n.velocity;
+	msg->enable = 1;
+	msg->duration = (rate > 1) ? rate / 2 : 1;
+	return 1;
+}
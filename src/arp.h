@@ -0,0 +1,22 @@
+/* arp.h
+   Arpeggiator on the live input. */
+
+#ifndef ARP_H
+#define ARP_H
+
+#include "sequencer.h"
+
+enum { ARP_OFF, ARP_UP, ARP_DOWN, ARP_UP_DOWN, ARP_RANDOM, ARP_PLAYED };
+
+#define ARP_NOTES 16								// Held notes, the oldest is dropped past this
+
+extern int arp_mode;
+
+void arp_set_mode(int mode);
+void arp_set_octaves(int octaves);
+void arp_set_rate(int ticks);
+void arp_note(unsigned char channel, unsigned char note, unsigned char velocity);
+int arp_due(unsigned int ticks);
+int arp_next(struct message *msg);
+
+#endif
@@ -0,0 +1,46 @@
+/* config.h
+   Build-time profiles sizing the sequencer to the RAM of the target.
+
+   Select a profile with `make PROFILE=<name>`, `make sizes` builds every
+   profile and prints what each one costs in RAM. The 32MX320F128H has
+   16 KB of data memory, shared with the stack.
+
+   COLUMNS     most steps a pattern can have, the length is set at runtime
+   ROWS        most messages in one step
+   POOL_SIZE   notes shared by all patterns, 8 bytes each
+   PATTERNS    patterns in the bank
+   UNDO_LENGTH undo steps, COLUMNS bytes each
+   SONG_LENGTH entries in the song */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#if defined(PROFILE_small)
+#define COLUMNS 32
+#define ROWS 32
+#define POOL_SIZE 384
+#define PATTERNS 4
+#define UNDO_LENGTH 8
+#define SONG_LENGTH 16
+#elif defined(PROFILE_long)
+#define COLUMNS 256
+#define ROWS 64
+#define POOL_SIZE 576
+#define PATTERNS 2
+#define UNDO_LENGTH 4
+#define SONG_LENGTH 16
+#else	/* PROFILE_default */
+#define COLUMNS 64
+#define ROWS 64
+#define POOL_SIZE 768
+#define PATTERNS 8
+#define UNDO_LENGTH 15
+#define SONG_LENGTH 32
+#endif
+
+#define METRONOME_CHANNEL 9		// MIDI channel 10, the General MIDI drum channel
+#define METRONOME_NOTE 100
+
+#define DEFAULT_LENGTH (COLUMNS < 32 ? COLUMNS : 32)	// Pattern length after clearing the bank
+
+#endif
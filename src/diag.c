@@ -0,0 +1,113 @@
+/* diag.c
+   Post-mortem diagnostics.
+
+   A general exception or an NMI goes to crash_capture in vectors.S, which
+   writes Cause, EPC, BadVAddr, sp, ra and the top of the stack into
+   crash_report and then resets the chip. crash_report and diag_state are
+   in their own .persist section which the linker places after .bss, so
+   they keep their contents through a software or watchdog reset.
+
+   diag_state counts busy-waits that timed out and watchdog resets, and
+   keeps a bitmap of the notes sounding at the output so they can be
+   turned off after a reset. It is cleared after power on.
+
+   On any boot but the first after power on, the notes that were sounding
+   get a note off. After a crash or a watchdog reset the reports are sent
+   as SysEx:
+     F0 7D 01 <RCON> <crash_report> F7			after a crash
+     F0 7D 02 <RCON> <diag_state counters> F7	after a crash or watchdog reset
+   7D is the non-commercial manufacturer ID. Every word is sent as eight
+   nibbles, most significant first, so the message stays 7-bit clean. */
+
+#include <pic32mx.h>
+#include "diag.h"
+#include "midi.h"
+
+#define SYSEX_START 0xF0
+#define SYSEX_END 0xF7
+#define SYSEX_ID 0x7D								// Non-commercial
+#define DIAG_CRASH 0x01
+#define DIAG_COUNTERS 0x02
+#define DIAG_COUNTER_WORDS 6					// spi_timeouts to step_overruns
+
+/* The layout is shared with vectors.S */
+typedef char diag_layout_check[
+	(sizeof(struct crash_report) == CRASH_REPORT_WORDS * 4 &&
+	 sizeof(struct diag_state) == DIAG_STATE_WORDS * 4) ? 1 : -1];
+
+static void send_word(unsigned int word) {
+	int shift;
+	for (shift = 28; shift >= 0; shift -= 4) {
+		midi_send_byte((word >> shift) & 0xF);
+	}
+}
+
+static void send_report(int type, unsigned int reset_cause, const unsigned int *words, int count) {
+	int i;
+	midi_send_byte(SYSEX_START);
+	midi_send_byte(SYSEX_ID);
+	midi_send_byte(type);
+	send_word(reset_cause);
+	for (i = 0; i < count; i++) {
+		send_word(words[i]);
+	}
+	midi_send_byte(SYSEX_END);
+}
+
+// Note off for every note left sounding before the reset
+static void release_notes() {
+	int channel, note;
+	for (channel = 0; channel < 16; channel++) {
+		for (note = 0; note < 128; note++) {
+			if (diag_state.sounding[channel][note >> 5] & (1 << (note & 31))) {
+				struct message msg = {0x80 | channel, note, 0, 0};
+				send_midi_message(msg);
+			}
+		}
+	}
+}
+
+/*
+	Checks why the chip was reset. Notes left on are released, and after a
+	crash or a watchdog reset the reports are sent. After power on the
+	diagnostics are cleared instead.
+*/
+void diag_report() {
+	unsigned int reset_cause = RCON;
+	int i;
+
+	RCONCLR = PIC32_RCON_POR | PIC32_RCON_BOR | PIC32_RCON_WDTO |
+		PIC32_RCON_SWR | PIC32_RCON_EXTR;
+	if (diag_state.magic != DIAG_MAGIC || (reset_cause & (PIC32_RCON_POR | PIC32_RCON_BOR))) {
+		unsigned int *words = (unsigned int *) &diag_state;
+		for (i = 0; i < DIAG_STATE_WORDS; i++) {
+			words[i] = 0;												// RAM is random after power on
+		}
+		diag_state.magic = DIAG_MAGIC;
+		crash_report.magic = 0;
+		return;
+	}
+	release_notes();
+	if (!(reset_cause & (PIC32_RCON_SWR | PIC32_RCON_WDTO))) {
+		return;																// Reset button, nothing went wrong
+	}
+	if (reset_cause & PIC32_RCON_WDTO) {
+		diag_state.watchdog_resets++;
+	}
+	if ((reset_cause & PIC32_RCON_SWR) && crash_report.magic == CRASH_MAGIC) {
+		send_report(DIAG_CRASH, reset_cause, (const unsigned int *) &crash_report, CRASH_REPORT_WORDS);
+	}
+	crash_report.magic = 0;								// Sent once
+	send_report(DIAG_COUNTERS, reset_cause, &diag_state.spi_timeouts, DIAG_COUNTER_WORDS);
+}
+
+/* Follows the notes sent to the output, called for every channel message */
+void diag_note(unsigned char command, unsigned char note, unsigned char velocity) {
+	unsigned int *word = &diag_state.sounding[command & 0xF][(note >> 5) & 3];
+	unsigned int bit = 1 << (note & 31);
+	if ((command & 0xF0) == 0x90 && velocity) {
+		*word |= bit;
+	} else if ((command & 0xF0) == 0x80 || (command & 0xF0) == 0x90) {
+		*word &= ~bit;
+	}
+}
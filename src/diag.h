@@ -0,0 +1,63 @@
+/* diag.h
+   Crash capture and the diagnostics report sent on boot.
+   Shared with vectors.S, which fills in the crash report. */
+
+#ifndef DIAG_H
+#define DIAG_H
+
+#define CRASH_MAGIC 0xDEAD5EC0
+#define CRASH_STACK_WORDS 8
+#define CRASH_REPORT_WORDS (7 + CRASH_STACK_WORDS)
+
+#define DATA_RAM_SIZE 0x4000			// PIC32MX320F128H, at 0x80000000
+
+#define DIAG_MAGIC 0xD1A65EC0
+#define DIAG_STATE_WORDS (7 + 16 * 4)
+
+#define CRASH_EXCEPTION 1
+#define CRASH_NMI 2
+
+/* Byte offsets in the crash report, for vectors.S */
+#define CRASH_OFFSET_MAGIC 0
+#define CRASH_OFFSET_KIND 4
+#define CRASH_OFFSET_CAUSE 8
+#define CRASH_OFFSET_EPC 12
+#define CRASH_OFFSET_BADVADDR 16
+#define CRASH_OFFSET_SP 20
+#define CRASH_OFFSET_RA 24
+#define CRASH_OFFSET_STACK 28
+
+#ifndef __ASSEMBLER__
+
+struct crash_report {
+	unsigned int magic;				// CRASH_MAGIC when the rest is valid
+	unsigned int kind;				// CRASH_EXCEPTION or CRASH_NMI
+	unsigned int cause;
+	unsigned int epc;					// ErrorEPC for an NMI
+	unsigned int badvaddr;
+	unsigned int sp;
+	unsigned int ra;
+	unsigned int stack[CRASH_STACK_WORDS];	// Words from sp up, 0 if sp was bad
+};
+
+/* Kept through a reset like the crash report, cleared after power on */
+struct diag_state {
+	unsigned int magic;				// DIAG_MAGIC once cleared after power on
+	unsigned int spi_timeouts;		// Busy-waits given up
+	unsigned int adc_timeouts;
+	unsigned int tx_timeouts;
+	unsigned int watchdog_resets;
+	unsigned int watchdog_tasks;	// Tasks that checked in since the last kick, see watchdog.c
+	unsigned int step_overruns;		// Steps with more notes than the output could send in time
+	unsigned int sounding[16][4];	// Notes on at the output, a bit per channel and note
+};
+
+extern struct crash_report crash_report;
+extern struct diag_state diag_state;
+
+void diag_report(void);
+void diag_note(unsigned char command, unsigned char note, unsigned char velocity);
+void crash_capture(int kind);
+
+#endif
+#endif
@@ -7,6 +7,18 @@
 #include <stdint.h>   /* Declarations of uint_32 and the like */
 #include <pic32mx.h>  /* Declarations of system-specific addresses etc */
 #include "display.h"  /* Declatations for these labs */
+#include "diag.h"
+#include "init.h"
+
+#define SPI_TIMEOUT_US 100		// A byte takes a few microseconds
+#define VDD_SETTLE_US 1000		// Logic supply on to reset
+#define VBAT_SETTLE_US 100000	// Panel supply on to display on
+
+/* Power-up runs in the background, see display_poll */
+enum { DISPLAY_VDD, DISPLAY_VBAT, DISPLAY_READY };
+static int display_state = DISPLAY_VDD;
+static unsigned int display_wait_start;
+static unsigned int display_wait_us;
 
 #define DISPLAY_CHANGE_TO_COMMAND_MODE (PORTFCLR = 0x10)
 #define DISPLAY_CHANGE_TO_DATA_MODE (PORTFSET = 0x10)
@@ -21,8 +33,14 @@
 #define DISPLAY_TURN_OFF_VBAT (PORTFSET = 0x20)
 
 
-char textbuffer[4][16];
-const uint8_t const font[];
+char textbuffer[4][TEXT_COLUMNS];
+static char shown[4][TEXT_COLUMNS];	/* What the display shows, cells that differ are sent */
+static int shown_valid = 0;		/* A bit per row whose shown cells are valid */
+static int condensed = 0;			/* A bit per row drawn with the 4x8 font */
+static int graphics = 0;		/* 1 while the framebuffer owns the display */
+static uint32_t page_buffer[32];	/* One page of pixels, composed a word at a time */
+const uint32_t font[];
+static const uint32_t font_condensed[128];
 const uint8_t const icon[];
 
 /* Helper function, local to this file.
@@ -65,13 +83,55 @@ void display_debug( volatile int * const addr )
   display_update();
 }
 
+/* Gives up on the display for good after the first timeout, so a dead
+   display costs one timeout and not one per byte */
+static int spi_failed = 0;
+
+/* Waits for the status bits in mask to equal value */
+static int spi_wait(int mask, int value) {
+	unsigned int start = read_core_timer();
+	while((SPI2STAT & mask) != value) {
+		if (read_core_timer() - start > SPI_TIMEOUT_US * CORE_TIMER_US) {
+			diag_state.spi_timeouts++;
+			spi_failed = 1;
+			return 0;
+		}
+	}
+	return 1;
+}
+
 uint8_t spi_send_recv(uint8_t data) {
-	while(!(SPI2STAT & 0x08));
+	if (spi_failed || !spi_wait(0x08, 0x08)) {
+		return 0;
+	}
 	SPI2BUF = data;
-	while(!(SPI2STAT & 1));
+	if (!spi_wait(1, 1)) {
+		return 0;
+	}
 	return SPI2BUF;
 }
 
+/* display_data:
+   Streams n bytes after display_cursor. Each byte is loaded while the one
+   before shifts out, so a run goes out back to back instead of waiting a
+   round trip per byte. The end waits for the shifter to empty, as the
+   mode pin may change next, and drops what was received. */
+void display_data(const uint8_t *data, int n) {
+	int i;
+	if (spi_failed)
+		return;
+	for (i = 0; i < n; i++) {
+		if (!spi_wait(0x08, 0x08))		/* SPITBE */
+			return;
+		SPI2BUF = data[i];
+		if (SPI2STAT & 1)							/* SPIRBF, keep the receive side empty */
+			(void) SPI2BUF;
+	}
+	spi_wait(0x800, 0);							/* SPIBUSY */
+	SPI2STATCLR = 0x40;							/* SPIROV */
+	(void) SPI2BUF;
+}
+
 void display_string_int(int row, char *str, int number) {
   display_string(row, str);
   display_int_indented(row, number);
@@ -79,11 +139,91 @@ void display_string_int(int row, char *str, int number) {
 }
 
 void display_int_indented(int row, int number) {
-  int s_pos = 7;
-  textbuffer[row][s_pos] = itoaconv(number)[0];
-  if (number > 9) {
-    textbuffer[row][s_pos+1] = itoaconv(number)[1];
+  display_number(row, 7, number);
+}
+
+/* Text formatting straight into textbuffer cells. Each function writes
+   from cell col of row, clips at the end of the row and returns the cell
+   after the last one written. Numbers below 1000 need no division. */
+
+static const char digit_pairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+static const char note_names[] = "C C#D D#E F F#G G#A A#B ";
+
+static int row_width(int row) {
+  return (condensed & (1 << row)) ? 32 : 16;
+}
+
+static int put_cell(int row, int col, char c) {
+  if (col < row_width(row))
+    textbuffer[row][col] = c;
+  return col + 1;
+}
+
+/* n < 1000, with leading zeros up to width cells */
+static int put_small(int row, int col, unsigned int n, int width) {
+  int hundreds = 0;
+  while (n >= 100) {
+    n -= 100;
+    hundreds++;
+  }
+  if (hundreds || width >= 3)
+    col = put_cell(row, col, '0' + hundreds);
+  if (hundreds || n >= 10 || width >= 2)
+    col = put_cell(row, col, digit_pairs[n * 2]);
+  return put_cell(row, col, digit_pairs[n * 2 + 1]);
+}
+
+int display_number(int row, int col, int number) {
+  unsigned int n = number;
+  if (row < 0 || row >= 4)
+    return col;
+  if (number < 0) {
+    col = put_cell(row, col, '-');
+    n = -n;
+  }
+  if (n >= 1000) {
+    col = display_number(row, col, n / 1000);
+    return put_small(row, col, n % 1000, 3);
+  }
+  return put_small(row, col, n, 0);
+}
+
+/* A fixed-point value in tenths, 1205 is written as 120.5. The digits are
+   written as one number, then the last one moves over for the point. */
+int display_tenths(int row, int col, int tenths) {
+  char last;
+  if (row < 0 || row >= 4)
+    return col;
+  if (tenths < 0) {
+    col = put_cell(row, col, '-');
+    tenths = -tenths;
+  }
+  if (tenths < 10)
+    col = put_cell(row, col, '0');		/* 0.5 rather than .5 */
+  col = display_number(row, col, tenths);
+  last = (col <= row_width(row)) ? textbuffer[row][col - 1] : ' ';
+  put_cell(row, col - 1, '.');
+  return put_cell(row, col, last);
+}
+
+/* A MIDI note number as a note name, 61 is written as C#4 */
+int display_note(int row, int col, int note) {
+  int octave = -1;
+  if (row < 0 || row >= 4)
+    return col;
+  note &= 0x7F;
+  while (note >= 12) {
+    note -= 12;
+    octave++;
   }
+  col = put_cell(row, col, note_names[note * 2]);
+  if (note_names[note * 2 + 1] != ' ')
+    col = put_cell(row, col, note_names[note * 2 + 1]);
+  return display_number(row, col, octave);
 }
 
 void display_init(void) {
@@ -108,24 +248,43 @@ void display_init(void) {
   SPI2CONSET = 0x8000;
 
   DISPLAY_CHANGE_TO_COMMAND_MODE;
-	quicksleep(10);
+	delay_us(1);
 	DISPLAY_ACTIVATE_VDD;
-	quicksleep(1000000);
-
-	spi_send_recv(0xAE);
-	DISPLAY_ACTIVATE_RESET;
-	quicksleep(10);
-	DISPLAY_DO_NOT_RESET;
-	quicksleep(10);
-
-	spi_send_recv(0x8D);
-	spi_send_recv(0x14);
-
-	spi_send_recv(0xD9);
-	spi_send_recv(0xF1);
+	display_state = DISPLAY_VDD;
+	display_wait_start = read_core_timer();
+	display_wait_us = VDD_SETTLE_US;
+}
 
-	DISPLAY_ACTIVATE_VBAT;
-	quicksleep(10000000);
+/* display_poll:
+   Steps the power-up sequence started by display_init, a step each time
+   its wait is over, so the sequencer can play meanwhile. Called from the
+   main loop, returns 1 once the display is on. Text written before that
+   is shown when it comes on. */
+int display_poll(void) {
+	if (display_state == DISPLAY_READY)
+		return 1;
+	if (read_core_timer() - display_wait_start < display_wait_us * CORE_TIMER_US)
+		return 0;
+
+	if (display_state == DISPLAY_VDD) {
+		spi_send_recv(0xAE);
+		DISPLAY_ACTIVATE_RESET;
+		delay_us(3);
+		DISPLAY_DO_NOT_RESET;
+		delay_us(3);
+
+		spi_send_recv(0x8D);
+		spi_send_recv(0x14);
+
+		spi_send_recv(0xD9);
+		spi_send_recv(0xF1);
+
+		DISPLAY_ACTIVATE_VBAT;
+		display_state = DISPLAY_VBAT;
+		display_wait_start = read_core_timer();
+		display_wait_us = VBAT_SETTLE_US;
+		return 0;
+	}
 
 	spi_send_recv(0xA1);
 	spi_send_recv(0xC8);
@@ -134,6 +293,9 @@ void display_init(void) {
 	spi_send_recv(0x20);
 
 	spi_send_recv(0xAF);
+	display_state = DISPLAY_READY;
+	display_update();
+	return 1;
 }
 
 void display_string(int line, char *s) {
@@ -143,7 +305,7 @@ void display_string(int line, char *s) {
 	if(!s)
 		return;
 
-	for(i = 0; i < 16; i++)
+	for(i = 0; i < row_width(line); i++)
 		if(*s) {
 			textbuffer[line][i] = *s;
 			s++;
@@ -154,6 +316,9 @@ void display_string(int line, char *s) {
 void display_image(int x, const uint8_t *data) {
 	int i, j;
 
+	if (display_state != DISPLAY_READY)
+		return;
+
 	for(i = 0; i < 4; i++) {
 		DISPLAY_CHANGE_TO_COMMAND_MODE;
 
@@ -168,194 +333,149 @@ void display_image(int x, const uint8_t *data) {
 		for(j = 0; j < 32; j++)
 			spi_send_recv(~data[i*32 + j]);
 	}
+	shown_valid = 0;		/* The image covers text cells */
 }
 
-void display_update(void) {
-	int i, j, k;
-	int c;
-	for(i = 0; i < 4; i++) {
-		DISPLAY_CHANGE_TO_COMMAND_MODE;
-		spi_send_recv(0x22);
-		spi_send_recv(i);
+/* display_graphics:
+   Hands the display to the framebuffer, or back to the text buffer when
+   on is 0. Text written meanwhile is kept and shown on the way back. */
+void display_graphics(int on) {
+	graphics = on;
+	if (!on) {
+		shown_valid = 0;
+		display_update();
+	}
+}
 
-		spi_send_recv(0x0);
-		spi_send_recv(0x10);
+/* Sets where the next data bytes go: page 0-3 and pixel column x */
+void display_cursor(int page, int x) {
+	DISPLAY_CHANGE_TO_COMMAND_MODE;
+	spi_send_recv(0x22);
+	spi_send_recv(page);
 
-		DISPLAY_CHANGE_TO_DATA_MODE;
+	spi_send_recv(0x0);		/* Page end, 0 as the original driver sent it, then the column */
+	spi_send_recv(x & 0xF);
+	spi_send_recv(0x10 | ((x >> 4) & 0xF));
 
-		for(j = 0; j < 16; j++) {
-			c = textbuffer[i][j];
-			if(c & 0x80)
-				continue;
+	DISPLAY_CHANGE_TO_DATA_MODE;
+}
+
+/* display_condensed:
+   Draws row with the 4x8 font and 32 cells when on is 1, or with the
+   8x8 font and 16 cells. The cells past 16 keep their text meanwhile. */
+void display_condensed(int row, int on) {
+	if (row < 0 || row >= 4 || !(condensed & (1 << row)) == !on)
+		return;
+	condensed ^= 1 << row;
+	shown_valid &= ~(1 << row);
+}
 
-			for(k = 0; k < 8; k++)
-				spi_send_recv(font[c*8 + k]);
+/* Composes text row into page_buffer. A glyph of the 8x8 font is two
+   words of the font table and a 4x8 glyph one word, already in the column
+   bytes the display takes, so a cell costs one or two word copies. */
+static void render_row(int row) {
+	int j, c;
+
+	for(j = 0; j < row_width(row); j++) {
+		c = textbuffer[row][j];
+		if(c & 0x80)
+			c = ' ';
+		if(condensed & (1 << row)) {
+			page_buffer[j] = font_condensed[c];
+		} else {
+			page_buffer[j * 2] = font[c * 2];
+			page_buffer[j * 2 + 1] = font[c * 2 + 1];
 		}
 	}
 }
 
-#define ITOA_BUFSIZ ( 24 )
-char * itoaconv( int num )
-{
-  register int i, sign;
-  static char itoa_buffer[ ITOA_BUFSIZ ];
-  static const char maxneg[] = "-2147483648";
-
-  itoa_buffer[ ITOA_BUFSIZ - 1 ] = 0;   /* Insert the end-of-string marker. */
-  sign = num;                           /* Save sign. */
-  if( num < 0 && num - 1 > 0 )          /* Check for most negative integer */
-  {
-    for( i = 0; i < sizeof( maxneg ); i += 1 )
-    itoa_buffer[ i + 1 ] = maxneg[ i ];
-    i = 0;
-  }
-  else
-  {
-    if( num < 0 ) num = -num;           /* Make number positive. */
-    i = ITOA_BUFSIZ - 2;                /* Location for first ASCII digit. */
-    do {
-      itoa_buffer[ i ] = num % 10 + '0';/* Insert next digit. */
-      num = num / 10;                   /* Remove digit from number. */
-      i -= 1;                           /* Move index to next empty position. */
-    } while( num > 0 );
-    if( sign < 0 )
-    {
-      itoa_buffer[ i ] = '-';
-      i -= 1;
-    }
-  }
-  /* Since the loop always sets the index i to the next empty position,
-   * we must add 1 in order to return a pointer to the first occupied position. */
-  return( &itoa_buffer[ i + 1 ] );
+/* Sends the cells of textbuffer that changed since the last update. A row
+   with changes is composed in page_buffer, then each run of changed cells
+   goes out as one burst. */
+void display_update(void) {
+	int i, j, start, width, cell;
+
+	if (display_state != DISPLAY_READY || graphics)
+		return;						// The text buffer goes out when the display is on
+	for(i = 0; i < 4; i++) {
+		int valid = shown_valid & (1 << i);
+		width = row_width(i);
+		cell = 128 / width;
+		for(j = 0; j < width && valid && shown[i][j] == textbuffer[i][j]; j++)
+			;
+		if(j == width)
+			continue;					/* Row unchanged */
+
+		render_row(i);
+		while(j < width) {
+			if(valid && shown[i][j] == textbuffer[i][j]) {
+				j++;
+				continue;
+			}
+			for(start = j; j < width && !(valid && shown[i][j] == textbuffer[i][j]); j++)
+				shown[i][j] = textbuffer[i][j];
+
+			display_cursor(i, start * cell);
+			display_data((const uint8_t *) page_buffer + start * cell, (j - start) * cell);
+		}
+	}
+	shown_valid = 0xF;
 }
 
-const uint8_t const font[] = {
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 94, 0, 0, 0, 0,
-	0, 0, 4, 3, 4, 3, 0, 0,
-	0, 36, 126, 36, 36, 126, 36, 0,
-	0, 36, 74, 255, 82, 36, 0, 0,
-	0, 70, 38, 16, 8, 100, 98, 0,
-	0, 52, 74, 74, 52, 32, 80, 0,
-	0, 0, 0, 4, 3, 0, 0, 0,
-	0, 0, 0, 126, 129, 0, 0, 0,
-	0, 0, 0, 129, 126, 0, 0, 0,
-	0, 42, 28, 62, 28, 42, 0, 0,
-	0, 8, 8, 62, 8, 8, 0, 0,
-	0, 0, 0, 128, 96, 0, 0, 0,
-	0, 8, 8, 8, 8, 8, 0, 0,
-	0, 0, 0, 0, 96, 0, 0, 0,
-	0, 64, 32, 16, 8, 4, 2, 0,
-	0, 62, 65, 73, 65, 62, 0, 0,
-	0, 0, 66, 127, 64, 0, 0, 0,
-	0, 0, 98, 81, 73, 70, 0, 0,
-	0, 0, 34, 73, 73, 54, 0, 0,
-	0, 0, 14, 8, 127, 8, 0, 0,
-	0, 0, 35, 69, 69, 57, 0, 0,
-	0, 0, 62, 73, 73, 50, 0, 0,
-	0, 0, 1, 97, 25, 7, 0, 0,
-	0, 0, 54, 73, 73, 54, 0, 0,
-	0, 0, 6, 9, 9, 126, 0, 0,
-	0, 0, 0, 102, 0, 0, 0, 0,
-	0, 0, 128, 102, 0, 0, 0, 0,
-	0, 0, 8, 20, 34, 65, 0, 0,
-	0, 0, 20, 20, 20, 20, 0, 0,
-	0, 0, 65, 34, 20, 8, 0, 0,
-	0, 2, 1, 81, 9, 6, 0, 0,
-	0, 28, 34, 89, 89, 82, 12, 0,
-	0, 0, 126, 9, 9, 126, 0, 0,
-	0, 0, 127, 73, 73, 54, 0, 0,
-	0, 0, 62, 65, 65, 34, 0, 0,
-	0, 0, 127, 65, 65, 62, 0, 0,
-	0, 0, 127, 73, 73, 65, 0, 0,
-	0, 0, 127, 9, 9, 1, 0, 0,
-	0, 0, 62, 65, 81, 50, 0, 0,
-	0, 0, 127, 8, 8, 127, 0, 0,
-	0, 0, 65, 127, 65, 0, 0, 0,
-	0, 0, 32, 64, 64, 63, 0, 0,
-	0, 0, 127, 8, 20, 99, 0, 0,
-	0, 0, 127, 64, 64, 64, 0, 0,
-	0, 127, 2, 4, 2, 127, 0, 0,
-	0, 127, 6, 8, 48, 127, 0, 0,
-	0, 0, 62, 65, 65, 62, 0, 0,
-	0, 0, 127, 9, 9, 6, 0, 0,
-	0, 0, 62, 65, 97, 126, 64, 0,
-	0, 0, 127, 9, 9, 118, 0, 0,
-	0, 0, 38, 73, 73, 50, 0, 0,
-	0, 1, 1, 127, 1, 1, 0, 0,
-	0, 0, 63, 64, 64, 63, 0, 0,
-	0, 31, 32, 64, 32, 31, 0, 0,
-	0, 63, 64, 48, 64, 63, 0, 0,
-	0, 0, 119, 8, 8, 119, 0, 0,
-	0, 3, 4, 120, 4, 3, 0, 0,
-	0, 0, 113, 73, 73, 71, 0, 0,
-	0, 0, 127, 65, 65, 0, 0, 0,
-	0, 2, 4, 8, 16, 32, 64, 0,
-	0, 0, 0, 65, 65, 127, 0, 0,
-	0, 4, 2, 1, 2, 4, 0, 0,
-	0, 64, 64, 64, 64, 64, 64, 0,
-	0, 0, 1, 2, 4, 0, 0, 0,
-	0, 0, 48, 72, 40, 120, 0, 0,
-	0, 0, 127, 72, 72, 48, 0, 0,
-	0, 0, 48, 72, 72, 0, 0, 0,
-	0, 0, 48, 72, 72, 127, 0, 0,
-	0, 0, 48, 88, 88, 16, 0, 0,
-	0, 0, 126, 9, 1, 2, 0, 0,
-	0, 0, 80, 152, 152, 112, 0, 0,
-	0, 0, 127, 8, 8, 112, 0, 0,
-	0, 0, 0, 122, 0, 0, 0, 0,
-	0, 0, 64, 128, 128, 122, 0, 0,
-	0, 0, 127, 16, 40, 72, 0, 0,
-	0, 0, 0, 127, 0, 0, 0, 0,
-	0, 120, 8, 16, 8, 112, 0, 0,
-	0, 0, 120, 8, 8, 112, 0, 0,
-	0, 0, 48, 72, 72, 48, 0, 0,
-	0, 0, 248, 40, 40, 16, 0, 0,
-	0, 0, 16, 40, 40, 248, 0, 0,
-	0, 0, 112, 8, 8, 16, 0, 0,
-	0, 0, 72, 84, 84, 36, 0, 0,
-	0, 0, 8, 60, 72, 32, 0, 0,
-	0, 0, 56, 64, 32, 120, 0, 0,
-	0, 0, 56, 64, 56, 0, 0, 0,
-	0, 56, 64, 32, 64, 56, 0, 0,
-	0, 0, 72, 48, 48, 72, 0, 0,
-	0, 0, 24, 160, 160, 120, 0, 0,
-	0, 0, 100, 84, 84, 76, 0, 0,
-	0, 0, 8, 28, 34, 65, 0, 0,
-	0, 0, 0, 126, 0, 0, 0, 0,
-	0, 0, 65, 34, 28, 8, 0, 0,
-	0, 0, 4, 2, 4, 2, 0, 0,
-	0, 120, 68, 66, 68, 120, 0, 0,
+/* 3x5 glyphs with a blank column, a word per glyph with the left column
+   in the low byte. Lowercase letters are drawn as capitals. */
+static const uint32_t font_condensed[128] = {
+	0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+	0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+	0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+	0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+	0x00000000, 0x00005C00, 0x000C000C, 0x007C287C, 0x00247C48, 0x00481024, 0x00685428, 0x00000C00,
+	0x00443800, 0x00003844, 0x00281028, 0x00103810, 0x00002040, 0x00101010, 0x00004000, 0x000C1060,
+	0x007C447C, 0x00407C48, 0x00485464, 0x00285444, 0x007C101C, 0x0024545C, 0x00745478, 0x000C7404,
+	0x007C547C, 0x003C545C, 0x00002800, 0x00002840, 0x00442810, 0x00282828, 0x00102844, 0x00085404,
+	0x00585438, 0x00781478, 0x0028547C, 0x00444438, 0x0038447C, 0x0054547C, 0x0014147C, 0x00744438,
+	0x007C107C, 0x00447C44, 0x003C4020, 0x006C107C, 0x0040407C, 0x007C187C, 0x007C387C, 0x00384438,
+	0x0008147C, 0x00786438, 0x0068147C, 0x00245448, 0x00047C04, 0x007C403C, 0x001C601C, 0x007C307C,
+	0x006C106C, 0x000C700C, 0x004C5464, 0x0000447C, 0x0060100C, 0x007C4400, 0x00080408, 0x00404040,
+	0x00000804, 0x00781478, 0x0028547C, 0x00444438, 0x0038447C, 0x0054547C, 0x0014147C, 0x00744438,
+	0x007C107C, 0x00447C44, 0x003C4020, 0x006C107C, 0x0040407C, 0x007C187C, 0x007C387C, 0x00384438,
+	0x0008147C, 0x00786438, 0x0068147C, 0x00245448, 0x00047C04, 0x007C403C, 0x001C601C, 0x007C307C,
+	0x006C106C, 0x000C700C, 0x004C5464, 0x00447C10, 0x00007C00, 0x00107C44, 0x00081810, 0x00000000,
+};
+
+/* 8x8 glyphs, two words per glyph with the left column in the low byte
+   of the first */
+const uint32_t font[128 * 2] = {
+	0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+	0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+	0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+	0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+	0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+	0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+	0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+	0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+	0x00000000, 0x00000000, 0x5E000000, 0x00000000, 0x03040000, 0x00000304, 0x247E2400, 0x00247E24,
+	0xFF4A2400, 0x00002452, 0x10264600, 0x00626408, 0x4A4A3400, 0x00502034, 0x04000000, 0x00000003,
+	0x7E000000, 0x00000081, 0x81000000, 0x0000007E, 0x3E1C2A00, 0x00002A1C, 0x3E080800, 0x00000808,
+	0x80000000, 0x00000060, 0x08080800, 0x00000808, 0x00000000, 0x00000060, 0x10204000, 0x00020408,
+	0x49413E00, 0x00003E41, 0x7F420000, 0x00000040, 0x51620000, 0x00004649, 0x49220000, 0x00003649,
+	0x080E0000, 0x0000087F, 0x45230000, 0x00003945, 0x493E0000, 0x00003249, 0x61010000, 0x00000719,
+	0x49360000, 0x00003649, 0x09060000, 0x00007E09, 0x66000000, 0x00000000, 0x66800000, 0x00000000,
+	0x14080000, 0x00004122, 0x14140000, 0x00001414, 0x22410000, 0x00000814, 0x51010200, 0x00000609,
+	0x59221C00, 0x000C5259, 0x097E0000, 0x00007E09, 0x497F0000, 0x00003649, 0x413E0000, 0x00002241,
+	0x417F0000, 0x00003E41, 0x497F0000, 0x00004149, 0x097F0000, 0x00000109, 0x413E0000, 0x00003251,
+	0x087F0000, 0x00007F08, 0x7F410000, 0x00000041, 0x40200000, 0x00003F40, 0x087F0000, 0x00006314,
+	0x407F0000, 0x00004040, 0x04027F00, 0x00007F02, 0x08067F00, 0x00007F30, 0x413E0000, 0x00003E41,
+	0x097F0000, 0x00000609, 0x413E0000, 0x00407E61, 0x097F0000, 0x00007609, 0x49260000, 0x00003249,
+	0x7F010100, 0x00000101, 0x403F0000, 0x00003F40, 0x40201F00, 0x00001F20, 0x30403F00, 0x00003F40,
+	0x08770000, 0x00007708, 0x78040300, 0x00000304, 0x49710000, 0x00004749, 0x417F0000, 0x00000041,
+	0x08040200, 0x00402010, 0x41000000, 0x00007F41, 0x01020400, 0x00000402, 0x40404000, 0x00404040,
+	0x02010000, 0x00000004, 0x48300000, 0x00007828, 0x487F0000, 0x00003048, 0x48300000, 0x00000048,
+	0x48300000, 0x00007F48, 0x58300000, 0x00001058, 0x097E0000, 0x00000201, 0x98500000, 0x00007098,
+	0x087F0000, 0x00007008, 0x7A000000, 0x00000000, 0x80400000, 0x00007A80, 0x107F0000, 0x00004828,
+	0x7F000000, 0x00000000, 0x10087800, 0x00007008, 0x08780000, 0x00007008, 0x48300000, 0x00003048,
+	0x28F80000, 0x00001028, 0x28100000, 0x0000F828, 0x08700000, 0x00001008, 0x54480000, 0x00002454,
+	0x3C080000, 0x00002048, 0x40380000, 0x00007820, 0x40380000, 0x00000038, 0x20403800, 0x00003840,
+	0x30480000, 0x00004830, 0xA0180000, 0x000078A0, 0x54640000, 0x00004C54, 0x1C080000, 0x00004122,
+	0x7E000000, 0x00000000, 0x22410000, 0x0000081C, 0x02040000, 0x00000204, 0x42447800, 0x00007844,
 };
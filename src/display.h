@@ -7,12 +7,22 @@
 
    For copyright and licensing, see file COPYING */
 
+#define TEXT_COLUMNS 32		/* Cells per row in the condensed font */
+
 /* Declare display-related functions from display.c */
 void display_image(int x, const uint8_t *data);
 void display_init(void);
+int display_poll(void);
+void display_graphics(int on);
+void display_cursor(int page, int x);
+void display_data(const uint8_t *data, int n);
+void display_condensed(int row, int on);
 void display_string(int line, char *s);
 void display_update(void);
 void display_int_indented(int row, int number);
+int display_number(int row, int col, int number);
+int display_tenths(int row, int col, int tenths);
+int display_note(int row, int col, int note);
 void display_string_int(int row, char *str, int number);
 uint8_t spi_send_recv(uint8_t data);
 
@@ -30,11 +40,10 @@ uint8_t spi_send_recv(uint8_t data);
 */
 void display_debug( volatile int * const addr );
 
-/* Declare bitmap array containing font */
-extern const uint8_t const font[128*8];
+/* Declare bitmap array containing font, two words per glyph */
+extern const uint32_t font[128*2];
 /* Declare bitmap array containing icon */
 extern const uint8_t const icon[128];
 /* Declare text buffer for display output */
-extern char textbuffer[4][16];
+extern char textbuffer[4][TEXT_COLUMNS];
 
-char * itoaconv( int num );
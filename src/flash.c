@@ -0,0 +1,55 @@
+/* flash.c
+   NVM driver for the pattern storage region in program flash.
+
+   The region is a page aligned array in .rodata that is initialised to the
+   erased state, so the linker reserves it and programming the hex file
+   leaves it empty. Reads go through KSEG1 so that data written by the NVM
+   controller is never served stale from the prefetch cache. */
+
+#include <pic32mx.h>
+#include "init.h"
+#include "flash.h"
+
+#define NVM_UNLOCK_KEY1 0xAA996655
+#define NVM_UNLOCK_KEY2 0x556699AA
+
+#define KVA_TO_PA(v) ((unsigned int)(v) & 0x1FFFFFFF)
+#define PA_TO_KVA1(p) ((p) | 0xA0000000)
+
+static const unsigned int storage_area[FLASH_STORAGE_PAGES * FLASH_PAGE_WORDS]
+	__attribute__((aligned(FLASH_PAGE_SIZE))) = {
+	[0 ... FLASH_STORAGE_PAGES * FLASH_PAGE_WORDS - 1] = 0xFFFFFFFF
+};
+
+/* Runs one NVM operation with the unlock sequence, returns 0 on success */
+static int nvm_operation(unsigned int op, unsigned int address, const void *source) {
+	NVMADDR = address;
+	if (source) {
+		NVMSRCADDR = KVA_TO_PA(source);
+	}
+
+	unsigned int status = disable_interrupt();	// Unlock sequence must not be interrupted
+	NVMCON = PIC32_NVMCON_WREN | op;
+	delay_us(10);												// Wait for the low voltage detect to settle (> 6 us)
+	NVMKEY = NVM_UNLOCK_KEY1;
+	NVMKEY = NVM_UNLOCK_KEY2;
+	NVMCONSET = PIC32_NVMCON_WR;
+	while (NVMCON & PIC32_NVMCON_WR);		// CPU stalls on flash fetches until done
+	NVMCONCLR = PIC32_NVMCON_WREN;
+	restore_interrupt(status);
+
+	return NVMCON & (PIC32_NVMCON_WRERR | PIC32_NVMCON_LVDERR);
+}
+
+const unsigned int *flash_page(int page) {
+	return (const unsigned int *) PA_TO_KVA1(KVA_TO_PA(&storage_area[page * FLASH_PAGE_WORDS]));
+}
+
+int flash_erase_page(int page) {
+	return nvm_operation(PIC32_NVMCON_PAGE_ERASE, KVA_TO_PA(&storage_area[page * FLASH_PAGE_WORDS]), 0);
+}
+
+int flash_program_row(int page, int row, const unsigned int *data) {
+	unsigned int address = KVA_TO_PA(&storage_area[page * FLASH_PAGE_WORDS + row * FLASH_ROW_WORDS]);
+	return nvm_operation(PIC32_NVMCON_ROW_PGM, address, data);
+}
@@ -0,0 +1,23 @@
+/* flash.h
+   Interface to the part of program flash reserved for pattern storage.
+
+   The storage log in storage.c only talks to flash through these functions,
+   so the NVM driver in flash.c can be swapped for another backing store
+   without touching the log format. Pages and rows are numbered from the
+   start of the reserved region. */
+
+#ifndef FLASH_H
+#define FLASH_H
+
+#define FLASH_PAGE_SIZE 4096										// Bytes erased by one page erase
+#define FLASH_ROW_SIZE 512											// Bytes written by one row program
+#define FLASH_PAGE_WORDS (FLASH_PAGE_SIZE / 4)
+#define FLASH_ROW_WORDS (FLASH_ROW_SIZE / 4)
+#define FLASH_ROWS_PER_PAGE (FLASH_PAGE_SIZE / FLASH_ROW_SIZE)
+#define FLASH_STORAGE_PAGES 8										// Pages reserved for the storage log
+
+const unsigned int *flash_page(int page);
+int flash_erase_page(int page);
+int flash_program_row(int page, int row, const unsigned int *data);
+
+#endif
@@ -0,0 +1,126 @@
+/* framebuffer.c
+   128x32 one bit per pixel image for the OLED.
+
+   The image is kept a column per 32-bit word, which matches the display:
+   each of its four pages takes one byte of every column word. A vertical
+   span is a single mask operation and a column can be replaced at once.
+   Columns are marked dirty when their word changes, and fb_flush sends
+   only runs of dirty columns.
+
+   One span of columns can be highlighted. It is inverted on the way out
+   and not stored, so moving it only dirties the columns it leaves and
+   enters. */
+
+#include <stdint.h>
+#include "display.h"
+#include "framebuffer.h"
+
+uint32_t framebuffer[FB_WIDTH];
+
+static uint32_t dirty[FB_WIDTH / 32];
+static int highlight_x0 = -1;
+static int highlight_x1 = -1;
+
+static void mark(int x) {
+	dirty[x >> 5] |= 1 << (x & 31);
+}
+
+static void mark_span(int x0, int x1) {
+	int x;
+	for (x = x0; x >= 0 && x <= x1 && x < FB_WIDTH; x++) {
+		mark(x);
+	}
+}
+
+void fb_clear() {
+	int x;
+	for (x = 0; x < FB_WIDTH; x++) {
+		fb_column(x, 0);
+	}
+}
+
+// Replaces a whole column
+void fb_column(int x, uint32_t pixels) {
+	if (x < 0 || x >= FB_WIDTH || framebuffer[x] == pixels) {
+		return;
+	}
+	framebuffer[x] = pixels;
+	mark(x);
+}
+
+// Sets rows y0 to y1 of column x
+void fb_vspan(int x, int y0, int y1) {
+	uint32_t mask;
+	if (y0 < 0) {
+		y0 = 0;
+	}
+	if (y1 >= FB_HEIGHT) {
+		y1 = FB_HEIGHT - 1;
+	}
+	if (y0 > y1) {
+		return;
+	}
+	mask = (y1 == 31 ? 0xFFFFFFFF : (2u << y1) - 1) & ~((1u << y0) - 1);
+	if (x >= 0 && x < FB_WIDTH) {
+		fb_column(x, framebuffer[x] | mask);
+	}
+}
+
+// Sets columns x0 to x1 of row y
+void fb_hspan(int y, int x0, int x1) {
+	int x;
+	if (y < 0 || y >= FB_HEIGHT) {
+		return;
+	}
+	for (x = (x0 < 0 ? 0 : x0); x <= x1 && x < FB_WIDTH; x++) {
+		fb_column(x, framebuffer[x] | (1u << y));
+	}
+}
+
+// Shows columns x0 to x1 inverted, x0 < 0 for none
+void fb_highlight(int x0, int x1) {
+	if (x0 == highlight_x0 && x1 == highlight_x1) {
+		return;
+	}
+	mark_span(highlight_x0, highlight_x1);
+	mark_span(x0, x1);
+	highlight_x0 = x0;
+	highlight_x1 = x1;
+}
+
+// Everything is sent again by the next flush
+void fb_invalidate() {
+	int i;
+	for (i = 0; i < FB_WIDTH / 32; i++) {
+		dirty[i] = 0xFFFFFFFF;
+	}
+}
+
+void fb_flush() {
+	uint8_t run[FB_WIDTH];
+	int page, x, start;
+	if (!display_poll()) {
+		return;														// Still powering up, stays dirty
+	}
+	for (page = 0; page < FB_HEIGHT / 8; page++) {
+		x = 0;
+		while (x < FB_WIDTH) {
+			if (!(dirty[x >> 5] & (1 << (x & 31)))) {
+				x++;
+				continue;
+			}
+			for (start = x; x < FB_WIDTH && (dirty[x >> 5] & (1 << (x & 31))); x++) {
+				uint32_t pixels = framebuffer[x];
+				if (x >= highlight_x0 && x <= highlight_x1) {
+					pixels = ~pixels;
+				}
+				run[x - start] = pixels >> (page * 8);
+			}
+			display_cursor(page, start);
+			display_data(run, x - start);		// The run goes out as one burst
+		}
+	}
+	for (x = 0; x < FB_WIDTH / 32; x++) {
+		dirty[x] = 0;
+	}
+}
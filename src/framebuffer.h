@@ -0,0 +1,22 @@
+/* framebuffer.h
+   128x32 one bit per pixel image for the OLED. */
+
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <stdint.h>
+
+#define FB_WIDTH 128
+#define FB_HEIGHT 32
+
+extern uint32_t framebuffer[FB_WIDTH];	// A word per column, bit 0 is the top row
+
+void fb_clear(void);
+void fb_column(int x, uint32_t pixels);
+void fb_vspan(int x, int y0, int y1);
+void fb_hspan(int y, int x0, int x1);
+void fb_highlight(int x0, int x1);
+void fb_invalidate(void);
+void fb_flush(void);
+
+#endif
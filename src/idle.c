@@ -0,0 +1,82 @@
+/* idle.c
+   Idle power management.
+
+   When a pass of the main loop leaves nothing to do, the CPU executes
+   wait and sleeps in Idle mode until the next interrupt: a Timer2 tick,
+   a MIDI byte, Timer3 while a step LED is dimmed (leds.c), or the idle
+   tick from Timer1 that keeps the buttons, switches and display polled.
+   SPI2 and the ADC are only used while the CPU runs, so they are set to
+   stop in Idle. While paused the idle tick slows down, which is all
+   Timer2 would otherwise wake the CPU for.
+
+   Timer1 also measures how long each wait lasted, giving cpu_busy. */
+
+#include <pic32mx.h>
+#include "init.h"
+#include "idle.h"
+
+#define TIMER1_HZ (PBCLK / 256)
+#define IDLE_TICK_HZ 100										// Inputs are polled at least this often
+#define PAUSED_TICK_HZ 25
+#define T1_IRQ (1 << 4)
+#define SIDL (1 << 13)											// Stop in Idle mode
+
+int cpu_busy = 100;
+
+static volatile unsigned int ticks = 0;
+static unsigned int tick_hz = IDLE_TICK_HZ;
+static unsigned int window_start = 0;				// Ticks when the measurement began
+static unsigned int idle_counts = 0;				// Timer1 counts spent in wait since
+
+void idle_init() {
+	SPI2CONSET = SIDL;
+	AD1CON1 |= SIDL;
+
+	T1CON = 0x0030;										// Prescale 1:256
+	PR1 = TIMER1_HZ / IDLE_TICK_HZ - 1;
+	TMR1 = 0;
+	IPCSET(1) = 1 << 2;								// Set prio = 1, it only wakes the CPU
+	IFSCLR(0) = T1_IRQ;
+	IECSET(0) = T1_IRQ;
+	T1CONSET = 0x8000;								// Timer on
+}
+
+void idle_tick_isr() {
+	ticks++;
+	IFSCLR(0) = T1_IRQ;
+}
+
+// Slower idle tick while paused, the measurement starts over
+void idle_paused(int paused) {
+	unsigned int status = disable_interrupt();
+	tick_hz = paused ? PAUSED_TICK_HZ : IDLE_TICK_HZ;
+	PR1 = TIMER1_HZ / tick_hz - 1;
+	TMR1 = 0;
+	window_start = ticks;
+	idle_counts = 0;
+	restore_interrupt(status);
+}
+
+/*
+	Called at the end of every pass of the main loop, with interrupts
+	disabled since the caller checked there is no work left, and waits for
+	an interrupt if may_wait. The M4K leaves wait when an interrupt is
+	pending even while they are disabled, so one that came after the check
+	is not slept through; it is taken when the caller enables them again.
+*/
+void idle(int may_wait) {
+	if (may_wait) {
+		unsigned int start = TMR1;
+		wait_for_interrupt();
+		unsigned int end = TMR1;
+		idle_counts += (end >= start) ? end - start : end + PR1 + 1 - start;
+	}
+
+	unsigned int elapsed = ticks - window_start;
+	if (elapsed >= tick_hz) {							// About a second
+		int busy = 100 - idle_counts / (elapsed * (PR1 + 1) / 100);
+		cpu_busy = (busy < 0) ? 0 : busy;
+		window_start = ticks;
+		idle_counts = 0;
+	}
+}
@@ -0,0 +1,14 @@
+/* idle.h
+   Idle power management. */
+
+#ifndef IDLE_H
+#define IDLE_H
+
+extern int cpu_busy;						// Percent of the last second spent running
+
+void idle_init(void);
+void idle_paused(int paused);
+void idle(int may_wait);
+void idle_tick_isr(void);
+
+#endif
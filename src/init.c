@@ -1,4 +1,18 @@
 #include <pic32mx.h>
+#include "init.h"
+#include "idle.h"
+#include "leds.h"
+
+#ifdef ISR_PROFILE
+unsigned int isr_entry_cycles[ISR_SOURCES];
+unsigned int isr_run_cycles[ISR_SOURCES];
+#endif
+
+/* Busy-waits at least us microseconds, up to about a minute */
+void delay_us(unsigned int us) {
+	unsigned int start = read_core_timer();
+	while (read_core_timer() - start < us * CORE_TIMER_US);
+}
 
 void shield_input_init() {
   /* Set all buttons and switches to input */
@@ -25,24 +39,16 @@ void shield_input_init() {
 
 void timer_init() {
   /* Timer setup */
-	T2CON = 0;
-	T2CON |= 0x0060;		// Prescale 1:256 (T2CON bit 6-4 = 110)
-	PR2 = 12500;				// Set period to 12500
+	T2CON = 0x0070;		// Prescale 1:256 (TCKPS, T2CON bit 6-4 = 111), TIMER2_HZ
+	PR2 = TIMER2_HZ / 48 - 1;	// One MIDI clock at 120 BPM, 24 clocks per beat
 	TMR2 = 0;						// Clear Timer2 counter
 
   /* Interrupt configuration */
 	IECSET(0) = 1 << 8;	// Enable interrupts for Timer2
-	IPCSET(2) = 0xE;		// Set prio = 3 & subprio = 2
+	IPCSET(2) = 0x1C;		// Set prio = 7, the clock goes before everything
 	IFSCLR(0) = 1 << 8;	// Clear interupt flag
 }
 
-void led_init() {
-  /* LED init */
-	ODCE = 0;
-	TRISECLR = 0xFF;   // Set LED pins as output
-  PORTECLR = 0xFF;   // Clear LEDs
-}
-
 int calculate_baudrate_divider(int sysclk, int baudrate, int highspeed) {
 	int pbclk, uxbrg, divmult;
 	unsigned int pbdiv;
@@ -70,25 +76,58 @@ void uart_init() {
 	OSCCONSET = 0x080000; // Set PBDIV bit 0
 
   /* Configure UART1 */
-  U1BRG = calculate_baudrate_divider(80000000, 31250, 0); // 31250 baudrate
+  U1BRG = calculate_baudrate_divider(SYSCLK, 31250, 0); // 31250 baudrate
   U1STA = 0;
   U1MODE = 0x8000; // 8-bit data, no parity, 1 stop bit
 
   /* Enable transmit and recieve */
   U1STASET = 0x1480;		// Set bit 12, 10 & 7
   U1STACLR = 0x40;			// Clear bit 6
+  U1STASET = PIC32_USTA_UTXISEL_EMP;	// Transmit interrupt when the FIFO is empty
 
   /* Interrupt configuration */
-  IECSET(0) = 1 << 27; 	// Enable recieve interrupt (U1RXIE set)
-  IPCSET(6) = 0x1f; 		// Set highest priority and subpriority
+  IECSET(0) = 1 << 27; 	// Enable recieve interrupt (U1RXIE set), transmit is enabled when queued
+  IPCSET(6) = 0x18; 		// Set prio = 6, below the clock
   IFSCLR(0) = 1 << 27; 	// Clear flag
+
+  /* Core software interrupt 0 parses the received bytes */
+  IPCSET(0) = 2 << 10;	// Set prio = 2
+  IFSCLR(0) = 1 << 1;
+  IECSET(0) = 1 << 1;
 }
 
+/*
+	Interrupt priorities. Every level but the top one runs with the levels
+	above it enabled (vectors.S), so a tick is never held up by MIDI input.
+
+	  7  Timer2    MIDI clock out, clock slave steering, step counting
+	  6  UART1     receive bytes into a queue, refill the transmit FIFO
+	  2  CS0       parse received bytes, thru, recording
+	  1  Timer1    idle tick, wakes the main loop to poll inputs
+	  1  Timer3    step LED dimming
+	  0  main loop
+
+	Worst case latency of a level is its entry cost plus the longest
+	section run with interrupts disabled plus one run of each level above.
+	Disabled sections are short queue and list updates, a few dozen
+	instructions, except a flash write which stalls the CPU anyway.
+
+	The figures here are estimates from reading the vector stubs, not
+	measurements: Timer2 should get in after about 30 cycles, UART1 after
+	that plus one Timer2 run, and the parser after both. Built with
+	ISR_PROFILE=1, isr_entry_cycles and isr_run_cycles measure them on the
+	board. Either way the receive FIFO holds bytes that take 320 us each,
+	far more than UART1 ever waits.
+*/
 void init() {
   uart_init();
-  led_init();
+  leds_init();
   timer_init();
   display_init();
   shield_input_init();
+  idle_init();
+#ifndef ISR_single
+	INTCONSET = PIC32_INTCON_MVEC;	// One vector per source, see vectors.S
+#endif
 	enable_interrupt(); // Enable interrupts globally
 }
@@ -1 +1,48 @@
+#define SYSCLK 80000000
+#define PBCLK (SYSCLK / 2)						// PBDIV is set to 2 in uart_init()
+#define TIMER2_HZ (PBCLK / 256)				// Timer2 count rate with its 1:256 prescaler
+#define CORE_TIMER_HZ (SYSCLK / 2)
+#define CORE_TIMER_US (CORE_TIMER_HZ / 1000000)	// Core timer counts per microsecond
+
 void init(void);
+void enable_interrupt(void);
+unsigned int disable_interrupt(void);
+void restore_interrupt(unsigned int status);
+unsigned int read_core_timer(void);
+void set_soft_interrupt(int on);
+void wait_for_interrupt(void);
+void delay_us(unsigned int us);
+
+#ifdef ISR_PROFILE
+/*
+	Worst case cycles from an interrupt vector to the handler body, and the
+	longest run of each handler. The vector stub leaves the core timer in
+	$k1, see vectors.S; a nested interrupt can cut an entry sample short.
+	Read the results with display_debug or a debugger.
+*/
+enum { ISR_SOURCE_TIMER2, ISR_SOURCE_UART1, ISR_SOURCE_PARSE, ISR_SOURCES };
+extern unsigned int isr_entry_cycles[ISR_SOURCES];
+extern unsigned int isr_run_cycles[ISR_SOURCES];
+
+static inline unsigned int isr_profile_entry(int source) {
+	unsigned int now, start;
+	asm volatile ("mfc0 %0, $9\n\tmove %1, $k1" : "=r" (now), "=r" (start));
+	if ((now - start) * 2 > isr_entry_cycles[source]) {
+		isr_entry_cycles[source] = (now - start) * 2;
+	}
+	return now;
+}
+
+static inline void isr_profile_exit(int source, unsigned int start) {
+	unsigned int cycles = (read_core_timer() - start) * 2;
+	if (cycles > isr_run_cycles[source]) {
+		isr_run_cycles[source] = cycles;
+	}
+}
+
+#define ISR_PROFILE_ENTRY(source) unsigned int isr_start_ = isr_profile_entry(source)
+#define ISR_PROFILE_EXIT(source) isr_profile_exit(source, isr_start_)
+#else
+#define ISR_PROFILE_ENTRY(source)
+#define ISR_PROFILE_EXIT(source)
+#endif
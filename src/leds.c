@@ -0,0 +1,77 @@
+/* leds.c
+   Step LEDs with brightness levels.
+
+   The eight LEDs on PORTE are dimmed with bit angle modulation: a frame
+   shows one bit plane per level bit, each for twice as long as the one
+   before, so a frame takes three Timer3 interrupts however many LEDs are
+   lit. When every LED is fully on or off Timer3 is stopped and the port
+   is written once, so it only wakes the CPU while something is dimmed.
+
+   leds_set is called at the step boundary before the first MIDI byte of
+   the step is queued, and writes the port itself instead of waiting for
+   the next plane, so the LEDs change with the step. */
+
+#include <pic32mx.h>
+#include "init.h"
+#include "leds.h"
+
+#define TIMER3_HZ (PBCLK / 256)
+#define FRAME_HZ 150													// Fast enough not to flicker
+#define PLANES 3															// log2 of LED_LEVELS
+#define UNIT (TIMER3_HZ / (FRAME_HZ * (LED_LEVELS - 1)))	// Timer3 counts of the shortest plane
+#define T3_IRQ (1 << 12)
+#define T3_ON 0x8000
+
+static volatile unsigned char planes[PLANES];	// LEDs lit during each plane
+static volatile int plane = 0;								// Plane on the port
+
+void leds_init() {
+	ODCE = 0;
+	TRISECLR = 0xFF;									// Set LED pins as output
+	PORTECLR = 0xFF;									// Clear LEDs
+
+	T3CON = 0x0070;										// Prescale 1:256, started by leds_set
+	IPCSET(3) = 1 << 2;								// Set prio = 1, like the idle tick
+	IFSCLR(0) = T3_IRQ;
+	IECSET(0) = T3_IRQ;
+}
+
+// Shows the next plane for its share of the frame
+void leds_pwm_isr() {
+	int next = (plane == PLANES - 1) ? 0 : plane + 1;
+	PORTE = planes[next];
+	PR3 = (UNIT << next) - 1;					// Timer3 just restarted from 0
+	plane = next;
+	IFSCLR(0) = T3_IRQ;
+}
+
+/*
+	Lights the LEDs in mask at level and the others at background, both
+	0 to LED_LEVELS - 1. Takes effect at once.
+*/
+void leds_set(int mask, int level, int background) {
+	unsigned char p[PLANES];
+	int i;
+	for (i = 0; i < PLANES; i++) {
+		p[i] = (level & (1 << i) ? mask : 0) | (background & (1 << i) ? ~mask : 0);
+	}
+
+	unsigned int status = disable_interrupt();
+	for (i = 0; i < PLANES; i++) {
+		planes[i] = p[i];
+	}
+	if (p[0] == p[1] && p[1] == p[2]) {			// Nothing dimmed
+		T3CONCLR = T3_ON;
+		IFSCLR(0) = T3_IRQ;
+		PORTE = p[0];
+	} else {
+		if (!(T3CON & T3_ON)) {
+			plane = 0;
+			PR3 = UNIT - 1;
+			TMR3 = 0;
+			T3CONSET = T3_ON;
+		}
+		PORTE = p[plane];
+	}
+	restore_interrupt(status);
+}
@@ -0,0 +1,17 @@
+/* leds.h
+   Step LEDs with brightness levels. */
+
+#ifndef LEDS_H
+#define LEDS_H
+
+#define LED_LEVELS 8								// Brightness 0 (off) to LED_LEVELS - 1 (full)
+#define LED_RECORD 1								// The unlit LEDs while recording
+#define LED_STEP 3
+#define LED_BEAT 5
+#define LED_ACCENT 7
+
+void leds_init(void);
+void leds_set(int mask, int level, int background);
+void leds_pwm_isr(void);
+
+#endif
@@ -1,13 +1,42 @@
+#include <stdint.h>
 #include <pic32mx.h>
 #include "init.h"
+#include "arp.h"
+#include "diag.h"
+#include "display.h"
+#include "framebuffer.h"
+#include "idle.h"
+#include "leds.h"
+#include "midi.h"
+#include "noteoff.h"
+#include "pianoroll.h"
+#include "sequencer.h"
+#include "song.h"
+#include "stepedit.h"
+#include "storage.h"
+#include "sync.h"
+#include "track.h"
+#include "trig.h"
+#include "watchdog.h"
 
-#define COLUMNS 32
-#define ROWS 64
-#define UNDO_LENGTH 15
+#define ADC_TIMEOUT_US 100									// A conversion takes a few microseconds
+#define ACCENT_VELOCITY 100									// Note ons this loud light the step LED fully
+#define HELD_NOTES 16												// Recorded notes waiting for their note off
+#define NOTE_ON_BYTES 3
+#define ERASE_KEYS 16												// Keys held down to erase with
+#define OVERRUN_SHOWN 40										// Tempo updates the overrun mark stays, about a second
+
+/* What recording does with notes already in the pattern, set by CC 38 */
+#define OVERDUB_ADD 0												// Keeps them
+#define OVERDUB_REPLACE 1										// Replaces the same pitch on the step a note lands on
+#define OVERDUB_ERASE 2											// Held keys erase their pitch as the playhead passes
 
 int current_column = 0;
-int time_counter = 0;		// Amount of 1/100-seconds from beginning of the loop
-int beat_length;				// Amount of 1/100-seconds per beat (changed with potentiometer)
+int time_counter = 0;		// Clock ticks since the current column started
+volatile unsigned int clock_ticks = 0;	// Clock ticks since power on, for note durations
+int tempo = 120;				// Beats per minute (changed with potentiometer)
+int next_period = 0;		// Timer2 period for the new tempo, applied on the next tick
+int steps_played = 0;		// Steps since playback started, for song position pointer
 int play = 1;						// Send MIDI from matrix
 int btns = 0;						// Stores pushbutton data for polling
 int record = 0;					// 1 if recording is on, 0 oterwise
@@ -15,94 +44,364 @@ int undo_index = 0;			// Current undo step
 int highest_note = 0;		// The highest note stored in the sequence
 int lowest_note = 127;		// The lowest note stored in the sequence
 int tempo_timer = 0;
+unsigned int shown_overruns = 0;		// Step overruns when the tempo row last looked
+int overrun_timer = 0;
+int roll_view = 0;			// 1 shows the piano roll instead of text, set by CC 28
+volatile int roll_stale = 1;	// The piano roll needs drawing again
 
-/* struct for MIDI messages */
-struct message {
-	unsigned char command;
+unsigned short channel_mute = 0;		// Bit n set mutes MIDI channel n + 1
+unsigned short channel_solo = 0;		// Bit n set solos MIDI channel n + 1
+unsigned short channel_mask = 0xFFFF;	// Channels allowed to play, from mute and solo
+unsigned short channels_used = 1;		// Channels that have been recorded on
+unsigned char channel_route[16] = {	// Output channel for each recorded channel
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+unsigned char prev_column_lengths[UNDO_LENGTH][COLUMNS];	// Stores copy of column_lengths for undo steps
+
+/* A recorded note on waiting for its note off to set the duration */
+struct held_note {
+	struct pattern *pattern;
+	unsigned short column;
+	unsigned short event;
+	unsigned char channel;			// As received, the stored note may be transposed meanwhile
 	unsigned char note;
-	unsigned char velocity;
-	unsigned char enable;
+	unsigned int start;					// Clock tick of the step the note was rounded to
 };
+struct held_note held[HELD_NOTES];	// Oldest first
+int held_count = 0;
 
-struct message messages[COLUMNS][ROWS];										// Matrix storing MIDI messages
-unsigned char column_lengths[COLUMNS];										// Number of messages stored in each column
-unsigned char prev_column_lengths[UNDO_LENGTH][COLUMNS];	// Stores copy of column_lengths for undo steps
+int overdub_mode = OVERDUB_ADD;
+unsigned short erase_keys[ERASE_KEYS];	// channel << 8 | note of the keys down in erase mode
+int erase_count = 0;
 
-/* Send MIDI message */
-void send_midi_message(struct message msg) {
-	while(U1STA & (1 << 9));	// Make sure the write buffer is not full
-	U1TXREG = msg.command;
-	while(U1STA & (1 << 9));	// Make sure the write buffer is not full
-	U1TXREG = msg.note;
-	while(U1STA & (1 << 9));	// Make sure the write buffer is not full
-	U1TXREG = msg.velocity;
+/*
+	Sets the duration of held note i from its start to now, unless an undo
+	or clear freed its event meanwhile. Called from the receive interrupt
+	or with interrupts disabled.
+*/
+void release_held(int i) {
+	struct held_note *h = &held[i];
+	unsigned short e;
+	for (e = h->pattern->first[h->column]; e != NO_EVENT && e != h->event; e = events[e].next);
+	if (e != NO_EVENT && events[e].msg.duration == 0) {
+		int duration = clock_ticks - h->start;			// Negative when let go before the rounded step
+		events[e].msg.duration = duration < 1 ? 1 : (duration > MAX_DURATION ? MAX_DURATION : duration);
+		storage_mark_dirty(pattern_index(h->pattern), h->column);
+		roll_stale = 1;
+	}
+	held_count--;
+	for (; i < held_count; i++) {
+		held[i] = held[i + 1];
+	}
 }
 
-void save_message(struct message msg) {
-	int save_column = current_column;
+// Ends every held note now, when recording or playback stops
+void release_all_held() {
+	unsigned int status = disable_interrupt();
+	while (held_count > 0) {
+		release_held(0);
+	}
+	restore_interrupt(status);
+}
 
-	if (time_counter > beat_length / 2) {
-		save_column = (save_column + 1) % COLUMNS; // Round to nearest column
-		msg.enable = 0;												 // Don't play the very next beat
+// Handles a recorded note off
+void note_released(unsigned char channel, unsigned char note) {
+	int i;
+	for (i = 0; i < held_count; i++) {
+		if (held[i].channel == channel && held[i].note == note) {
+			release_held(i);
+			return;
+		}
 	}
+}
 
-	if (column_lengths[save_column] < ROWS) { // Make sure we don't overflow messages in save_column
-		messages[save_column][column_lengths[save_column]] = msg;	// Add message struct to array
-		column_lengths[save_column]++;
+/*
+	Removes recorded event e, the index-th of column, prev being the one
+	before it. Undo steps that still had it keep the notes around it, so a
+	removal is not undone but the notes recorded since it still are.
+*/
+void remove_recorded(struct pattern *p, int column, unsigned short prev, unsigned short e, int index) {
+	int i;
+	unsigned int status = disable_interrupt();
+	pattern_remove(p, column, prev, e);
+	if (p == current_pattern) {
+		for (i = 0; i <= undo_index; i++) {
+			if (prev_column_lengths[i][column] > index) {
+				prev_column_lengths[i][column]--;
+			}
+		}
 	}
+	restore_interrupt(status);
+	storage_mark_dirty(pattern_index(p), column);
+	roll_stale = 1;
 }
 
-/* Interrupt Service Routine */
-void user_isr( void ) {
-	/* MIDI receive interrupt */
-	if (IFS(0) & (1 << 27)) {
-		unsigned char cmd = U1RXREG & 0xFF;
-		if (cmd != 0x90 && cmd != 0x80) {
-			IFSCLR(0) = 1 << 27;	// Clear interrupt flag
-			return;
+/*
+	Removes the notes of channel and note from column of the playing
+	pattern, except ones still held while recording. Only looks through
+	the column when the pitch index says the note may be there.
+*/
+void remove_notes(int column, unsigned char channel, unsigned char note) {
+	if (!pattern_may_hold(column, note)) {
+		return;
+	}
+	unsigned short prev = NO_EVENT;
+	unsigned short e = current_pattern->first[column];
+	int index = 0;
+	while (e != NO_EVENT) {
+		unsigned short next = events[e].next;
+		struct message m = events[e].msg;
+		if (m.note == note && (m.command & 0xF) == channel && m.duration) {
+			remove_recorded(current_pattern, column, prev, e, index);
+		} else {
+			prev = e;
+			index++;
 		}
-		unsigned char note = U1RXREG & 0xFF;
-		if (note >> 7) {
-			IFSCLR(0) = 1 << 27;	// Clear interrupt flag
-			return;
+		e = next;
+	}
+}
+
+// Erases the pitches of the keys held in erase mode from the step about to play
+void erase_held_keys() {
+	int i;
+	unsigned int status = disable_interrupt();	// The receive interrupt changes the keys
+	for (i = 0; i < erase_count; i++) {
+		unsigned char channel = erase_keys[i] >> 8;
+		remove_notes(track_column(channel, current_column), channel, erase_keys[i] & 0x7F);
+	}
+	restore_interrupt(status);
+}
+
+// Adds or, for velocity 0, removes a key held down in erase mode
+void erase_key(unsigned char channel, unsigned char note, unsigned char velocity) {
+	unsigned short key = (channel << 8) | note;
+	int i;
+	for (i = 0; i < erase_count && erase_keys[i] != key; i++);
+	if (i < erase_count) {
+		erase_keys[i] = erase_keys[--erase_count];
+	}
+	if (velocity) {
+		if (erase_count == ERASE_KEYS) {
+			erase_count--;
 		}
-		unsigned char vel = U1RXREG & 0xFF;
-		IFSCLR(0) = 1 << 27;	// Clear interrupt flag
-		if (vel >> 7) {
+		erase_keys[erase_count++] = key;
+	}
+}
+
+void save_message(struct message msg) {
+	int channel = msg.command & 0xF;
+	int save_column = track_column(channel, current_column);
+	unsigned int start = clock_ticks - time_counter;	// Start of the playing step
+
+	if (time_counter >= CLOCKS_PER_STEP / 2) {
+		if (++save_column >= track_length(current_pattern, channel)) { // Round to nearest column
+			save_column = 0;
+		}
+		msg.enable = 0;												 // Don't play the very next beat
+		start += CLOCKS_PER_STEP;
+	}
+	msg.skip = trig_record_skip;
+	msg.condition = trig_record_condition;
+	if (overdub_mode == OVERDUB_REPLACE) {
+		remove_notes(save_column, channel, msg.note);
+	}
+	if (pattern_append(current_pattern, save_column, msg)) { // Fails if save_column or the pool is full
+		storage_mark_dirty(pattern_index(current_pattern), save_column);
+		roll_stale = 1;
+		if (msg.duration) {										// Known already, from the arpeggiator
 			return;
 		}
+		if (held_count == HELD_NOTES) {
+			release_held(0);
+		}
+		struct held_note *h = &held[held_count++];
+		h->pattern = current_pattern;
+		h->column = save_column;
+		h->event = current_pattern->last[save_column];
+		h->channel = channel;
+		h->note = msg.note;
+		h->start = start;
+	}
+}
 
-		struct message msg = {
-			cmd,
-			note,
-			vel,
-			1
-		};
+// Mute and solo are folded into one mask so playback tests a single bit
+void update_channel_mask() {
+	channel_mask = channel_solo ? channel_solo : ~channel_mute;
+}
 
-		// Only save when record & play is enabled
-		if (record && play) {
+/*
+	Control changes used to set up the sequencer, channel is the one the
+	control change was sent on:
+		20, 21	pattern length value + 1, value + 129
+		22			mute channel when value >= 64
+		23			solo channel when value >= 64
+		24			play channel on output channel value + 1
+		28			piano roll on the display when value >= 64
+		29			arpeggiator mode value / 16: off, up, down, up-down, random,
+						as played
+		30			arpeggiator octaves value + 1, up to 4
+		31			arpeggiator rate 1/32, 1/16, 1/8, 1/4 note for value 0-3
+		32			chance of notes recorded from now on, 0 never to 127 always
+		33			condition of notes recorded from now on, see trig.h
+		34			fill when value >= 64
+		35			seed of the chances, 0 for none
+		36, 37	own length of the channel value, value + 128, 0 follows the
+						pattern length
+		38			overdub value / 32: add, replace, erase
+*/
+void control_change(int channel, int controller, int value) {
+	unsigned short bit = 1 << channel;
+	switch (controller) {
+		case 20:
+		case 21:
+			pattern_set_length(current_pattern, value + 1 + (controller == 21 ? 128 : 0));
+			storage_mark_length_dirty();
+			roll_stale = 1;
+			break;
+		case 22:
+			channel_mute = (value >= 64) ? (channel_mute | bit) : (channel_mute & ~bit);
+			update_channel_mask();
+			break;
+		case 23:
+			channel_solo = (value >= 64) ? (channel_solo | bit) : (channel_solo & ~bit);
+			update_channel_mask();
+			break;
+		case 24:
+			channel_route[channel] = value & 0xF;
+			break;
+		case 25:
+			thru_channel = (value >= 1 && value <= 16) ? value - 1 : -1;
+			break;
+		case 26:
+			thru_note_low = value;
+			break;
+		case 27:
+			thru_note_high = value;
+			break;
+		case 28:
+			roll_view = value >= 64;
+			break;
+		case 29:
+			arp_set_mode(value / 16);
+			break;
+		case 30:
+			arp_set_octaves(value + 1);
+			break;
+		case 31:
+			arp_set_rate((CLOCKS_PER_STEP / 2) << (value > 3 ? 3 : value));
+			break;
+		case 32:
+			trig_set_chance(value);
+			break;
+		case 33:
+			trig_set_condition(value);
+			break;
+		case 34:
+			trig_fill = value >= 64;
+			break;
+		case 35:
+			trig_set_seed(value);
+			break;
+		case 36:
+		case 37:
+			pattern_set_track_length(current_pattern, channel, value + (controller == 37 ? 128 : 0));
+			storage_mark_tracks_dirty(pattern_index(current_pattern));
+			break;
+		case 38:
+			overdub_mode = (value / 32 > OVERDUB_ERASE) ? OVERDUB_ERASE : value / 32;
+			erase_count = 0;
+			break;
+	}
+}
 
-			if (note > highest_note) {
-				highest_note = note;
-			}
-			if (note < lowest_note) {
-				lowest_note = note;
-			}
+/* Handles a complete MIDI message from the receive interrupt */
+void midi_message_received(unsigned char cmd, unsigned char data1, unsigned char data2) {
+	if ((cmd & 0xF0) == 0xC0) {				// Program change queues a pattern
+		if (record && !play) {			// Paused with record on edits the song
+			song_append(data1 % PATTERNS);
+		} else {
+			queued_pattern = data1 % PATTERNS;
+			song_active = 0;
+		}
+		return;
+	}
+	if ((cmd & 0xF0) == 0xB0) {
+		control_change(cmd & 0xF, data1, data2);
+		return;
+	}
+	if (cmd == MIDI_SONG_POSITION) {
+		sync_song_position(data1 | (data2 << 7));
+		return;
+	}
+	if ((cmd & 0xF0) != 0x90 && (cmd & 0xF0) != 0x80) {	// Note on and off on any channel
+		return;
+	}
+	if (arp_mode) {													// Held for the arpeggiator, which records what it plays
+		arp_note(cmd & 0xF, data1, (cmd & 0xF0) == 0x90 ? data2 : 0);
+		return;
+	}
+
+	struct message msg = {
+		cmd,
+		data1,
+		data2,
+		1
+	};
 
+	// Only save when record & play is enabled
+	if (record && play && overdub_mode == OVERDUB_ERASE) {
+		erase_key(cmd & 0xF, data1, (cmd & 0xF0) == 0x90 ? data2 : 0);
+	} else if (record && play) {
+		if ((cmd & 0xF0) == 0x90 && data2) {
+			channels_used |= 1 << (cmd & 0xF);
 			save_message(msg);
+		} else {
+			note_released(cmd & 0xF, data1);			// Sets the duration of its note on
 		}
-
-		if (get_sw() & 1) {
-			send_midi_message(msg);
+	} else if (record) {											// Paused, entered on the step shown
+		if (stepedit_note(current_pattern, current_column, cmd & 0xF, data1, (cmd & 0xF0) == 0x90 ? data2 : 0)) {
+			channels_used |= 1 << (cmd & 0xF);
+			roll_stale = 1;
 		}
+	}
+}
 
+/* Interrupt Service Routine */
+/* Timer2 interupt, one tick per MIDI clock */
+void timer2_isr( void ) {
+	ISR_PROFILE_ENTRY(ISR_SOURCE_TIMER2);
+	if (clock_out) {
+		midi_realtime(MIDI_CLOCK);		// First thing, so the clock has the least jitter
 	}
-	/* Timer2 interupt */
+	sync_tick();
+	if (next_period) {						// Timer2 restarts from 0 on its own, safe to change now
+		PR2 = next_period;
+		next_period = 0;
+	}
+	time_counter++;
+	clock_ticks++;
+	tempo_timer++;
+	IFSCLR(0) = 1 << 8;	// Clear interupt flag
+	ISR_PROFILE_EXIT(ISR_SOURCE_TIMER2);
+}
+
+/* Every interrupt without a vector of its own, see vectors.S */
+void user_isr( void ) {
 	if (IFS(0) & (1 << 8)) {
-		time_counter++;
-		tempo_timer++;
-		TMR2 = 0;						// Clear Timer2 counter
-		IFSCLR(0) = 1 << 8;	// Clear interupt flag
+		timer2_isr();
+	}
+	/* MIDI receive and transmit interrupts */
+	if (IFS(0) & (3 << 27)) {
+		midi_uart_isr();
+	}
+	if (IFS(0) & (1 << 1)) {
+		midi_parse_isr();
+	}
+	if (IFS(0) & (1 << 4)) {
+		idle_tick_isr();
+	}
+	if (IFS(0) & (1 << 12)) {
+		leds_pwm_isr();
 	}
 }
 
@@ -128,86 +427,129 @@ void display_midi_info(struct message m) {
 		display_string(1, "Something else");
 	}
 
-	/* Note */
-	unsigned char note_check = m.note;
-	display_string(2, itoaconv(note_check));
+	/* Note, as a name and a number */
+	display_string(2, "");
+	display_number(2, display_note(2, 0, m.note) + 1, m.note);
 
 	/* Velocity */
-	unsigned char velocity_check = m.velocity;
-	display_string(3, itoaconv(velocity_check));
+	display_string(3, "");
+	display_number(3, 0, m.velocity);
 	display_update();
 }
 
 // Sends a note on and off for the same note in the same beat
 void metronome() {
-	struct message note_on = {0x90, 100, 50, 0};
-	struct message note_off = {0x80, 100, 0, 0};
+	struct message note_on = {0x90 | METRONOME_CHANNEL, METRONOME_NOTE, 50, 0};
+	struct message note_off = {0x80 | METRONOME_CHANNEL, METRONOME_NOTE, 0, 0};
 	send_midi_message(note_on);
 	send_midi_message(note_off);
 }
 
-// Sends note off messages for all notes 4 times
+// Adds the channels of every note in the bank to channels_used, after loading it
+void find_channels_used() {
+	int p, column;
+	unsigned short e;
+	for (p = 0; p < PATTERNS; p++) {
+		for (column = 0; column < COLUMNS; column++) {
+			for (e = patterns[p].first[column]; e != NO_EVENT; e = events[e].next) {
+				channels_used |= 1 << (events[e].msg.command & 0xF);
+			}
+		}
+	}
+}
+
+// Sends note off messages for all notes 4 times on every output channel in use
 void all_notes_off() {
-	int i, j;
-	for (j = 0; j < 4; j++) {
-		for (i = 0; i < 128; i++) {
-			struct message msg = {0x80, i, 0, 0};
-			send_midi_message(msg);
+	int i, j, channel;
+	unsigned short outputs = 0;
+	noteoff_flush();														// Also the arpeggiator's, on the thru channel
+	for (channel = 0; channel < 16; channel++) {
+		if (channels_used & (1 << channel)) {
+			outputs |= 1 << channel_route[channel];
+		}
+	}
+	for (channel = 0; channel < 16; channel++) {
+		if (!(outputs & (1 << channel))) {
+			continue;
+		}
+		for (j = 0; j < 4; j++) {
+			for (i = 0; i < 128; i++) {
+				struct message msg = {0x80 | channel, i, 0, 0};
+				send_midi_message(msg);
+			}
+			watchdog_clear();									// A round takes an eighth of a second
 		}
 	}
 }
 
 /*
-Goes through the column played 2 beats ago and:
-	- Removes duplicated note on messages for the same note in the same column.
-	- If a note has both a note on and note off in the same column, move the note of
-	  to the next column
+Goes through the column played 2 beats ago and removes duplicated note on
+messages for the same note in the same column, the first one keeps the
+longer duration
 */
 void fix_previous_column() {
-	int cleanup_column = (current_column + COLUMNS - 2) % COLUMNS;
-	int i;
-	for (i = 0; i < column_lengths[cleanup_column]; i++) {
-		struct message msg1 = messages[cleanup_column][i];
-		if (msg1.command == 0x90) {
-			int j;
-			for (j = i+1; j < column_lengths[cleanup_column]; j++) {
-				struct message msg2 = messages[cleanup_column][j];
-				if (msg1.note == msg2.note) {
-					if (msg2.command == 0x80) {
-						// Move msg2 to next column
-						int next_column = (cleanup_column + 1) % COLUMNS;
-						messages[next_column][column_lengths[next_column]] = messages[cleanup_column][j];
-						column_lengths[next_column]++;
+	struct pattern *p = current_pattern;
+	int cleanup_column = current_column - 2;
+	if (cleanup_column < 0) {
+		cleanup_column += p->length;
+	}
+	if (cleanup_column < 0) {									// Patterns of length 1
+		cleanup_column = 0;
+	}
+	unsigned short e1;
+	for (e1 = p->first[cleanup_column]; e1 != NO_EVENT; e1 = events[e1].next) {
+		struct message msg1 = events[e1].msg;
+		if ((msg1.command & 0xF0) == 0x90) {
+			unsigned short prev = e1;
+			unsigned short e2 = events[e1].next;
+			while (e2 != NO_EVENT) {
+				unsigned short next = events[e2].next;
+				struct message msg2 = events[e2].msg;
+				if (msg1.note == msg2.note && (msg1.command & 0xF) == (msg2.command & 0xF)) {
+					if (events[e1].msg.duration && msg2.duration > events[e1].msg.duration) {
+						events[e1].msg.duration = msg2.duration;	// Unless the first is still held
 					}
-					// Put last message on place j and decrement column_lengths
-					messages[cleanup_column][j] = messages[cleanup_column][column_lengths[cleanup_column] - 1];
-					column_lengths[cleanup_column]--;
-					j--;	// Compare msg1 with moved message next iteration
+					pattern_remove(p, cleanup_column, prev, e2);
+					storage_mark_dirty(pattern_index(p), cleanup_column);
+				} else {
+					prev = e2;
 				}
+				e2 = next;
 			}
 		}
 	}
 }
 
-// Set all values in column_lengths to 0
-void clear_column_array(unsigned char *arr) {
-	int i;
-	for (i = 0; i < COLUMNS; i++) {
-		arr[i] = 0;
-	}
-}
-
 // Returns 1 if any value in column_lengths is different from the value in the last saved version.
 int notes_recorded() {
 	int i;
 	for (i = 0; i < COLUMNS; i++) { // Check if column_lengths changed
-		if (prev_column_lengths[undo_index][i] != column_lengths[i]) {
+		if (prev_column_lengths[undo_index][i] != current_pattern->column_lengths[i]) {
 			return 1;
 		}
 	}
 	return 0;
 }
 
+// Looks up the highest and lowest note stored in the playing pattern
+void update_note_range() {
+	int i;
+	unsigned short e;
+	highest_note = 0;
+	lowest_note = 127;
+	for (i = 0; i < COLUMNS; i++) {
+		for (e = current_pattern->first[i]; e != NO_EVENT; e = events[e].next) {
+			unsigned char note = events[e].msg.note;
+			if (note > highest_note) {
+				highest_note = note;
+			}
+			if (note < lowest_note) {
+				lowest_note = note;
+			}
+		}
+	}
+}
+
 /*
 	If neither the highest nor lowest note is the highest/lowest possible note
 	shift all notes either up or down by one depending on if the transpose switch
@@ -215,78 +557,306 @@ int notes_recorded() {
 */
 void transpose() {
 	int transpose_up = get_sw() & 2;
+	update_note_range();
 	if (!(transpose_up && highest_note == 127) && !(!transpose_up && lowest_note == 0)) {
-		if (transpose_up) {
-			highest_note++;
-			lowest_note++;
-		} else {
-			highest_note--;
-			lowest_note--;
-		}
-		int i, j;
+		int i;
+		unsigned short e;
 		for (i = 0; i < COLUMNS; i++) {
-			for (j = 0; j < column_lengths[i]; j++) {
+			for (e = current_pattern->first[i]; e != NO_EVENT; e = events[e].next) {
 				if (transpose_up) {
-					messages[i][j].note++;
+					events[e].msg.note++;
 				} else {
-					messages[i][j].note--;
+					events[e].msg.note--;
 				}
 			}
 		}
+		pattern_index_notes();
+		storage_mark_all_dirty(pattern_index(current_pattern));	// Written at the next save point
+		roll_stale = 1;
 	}
 	all_notes_off();
 }
 
-// Toggles the timer and displays current state
-void play_pause() {
-	if (play) {
-		play = 0;
-		T2CON &= ~0x8000;		// Timer off
+/*
+	Lights the LED of the current step, brighter on a beat or at level, and
+	lets the others glow while recording
+*/
+void show_step(int level) {
+	if (level < 0) {
+		level = (current_column & 3) ? LED_STEP : LED_BEAT;
+	}
+	leds_set(1 << (7 - (current_column & 7)), level, record ? LED_RECORD : 0);
+}
+
+/*
+	Bytes the output can send before the next step at the Timer2 period,
+	less what is still queued and the timing clocks of the step
+*/
+int step_room() {
+	return (int) ((PR2 + 1) * CLOCKS_PER_STEP * MIDI_BYTES_PER_SECOND / TIMER2_HZ) -
+		midi_queued() - (clock_out ? CLOCKS_PER_STEP : 0);
+}
+
+/*
+	Sends the note ons of the current column, and of the columns tracks with
+	their own length are on, loudest first. Notes past the step_room() of
+	the step would run into the next step, so the softest are left out
+	this time round and the step counts as an overrun. Note offs are sent
+	by noteoff_service before the step, so they always get through.
+*/
+void play_column(unsigned int step_tick) {
+	unsigned short notes[ROWS];
+	unsigned short columns[TRACKS + 1];
+	unsigned short channels[TRACKS + 1];
+	int groups = track_groups(current_column, columns, channels);
+	int count = 0;
+	int g, i;
+	unsigned short e;
+
+	for (g = 0; g < groups; g++) {
+		for (e = current_pattern->first[columns[g]]; e != NO_EVENT; e = events[e].next) {
+			struct message msg = events[e].msg;
+			unsigned short bit = 1 << (msg.command & 0xF);
+			if (!(channels[g] & bit)) {						// Its track is on another column
+				continue;
+			}
+			if (!msg.enable) {
+				events[e].msg.enable = 1;
+			} else if (msg.duration && (channel_mask & bit) && trig_plays(msg)) {	// Not while still held or muted
+				if (count == ROWS) {								// Only the loudest ROWS fit
+					if (events[notes[ROWS - 1]].msg.velocity >= msg.velocity) {
+						continue;
+					}
+					count--;
+				}
+				for (i = count; i > 0 && events[notes[i - 1]].msg.velocity < msg.velocity; i--) {
+					notes[i] = notes[i - 1];
+				}
+				notes[i] = e;
+				count++;
+			}
+		}
+	}
+
+	int room = step_room();
+	if (count * NOTE_ON_BYTES > room) {
+		diag_state.step_overruns++;
+		count = (room > 0) ? room / NOTE_ON_BYTES : 0;
+	}
+
+	if (count > 0 && events[notes[0]].msg.velocity >= ACCENT_VELOCITY) {
+		show_step(LED_ACCENT);
+	}
+	for (i = 0; i < count; i++) {
+		struct message msg = events[notes[i]].msg;
+		unsigned char channel = channel_route[msg.command & 0xF];
+		msg.command = 0x90 | channel;
+		noteoff_start(channel, msg.note, step_tick + msg.duration);
+		send_midi_message(msg);
+	}
+}
+
+/*
+	Plays the next arpeggiator note when its time has come, on the thru
+	channel, and records it with its duration while recording
+*/
+void play_arp() {
+	struct message msg;
+	unsigned int status = disable_interrupt();	// The receive interrupt changes the held notes
+	int due = arp_due(current_column * CLOCKS_PER_STEP + time_counter) && arp_next(&msg);
+	restore_interrupt(status);
+	if (!due) {
+		return;
+	}
+
+	unsigned char channel = (thru_channel < 0) ? (msg.command & 0xF) : thru_channel;
+	struct message out = msg;
+	out.command = 0x90 | channel;
+	noteoff_start(channel, msg.note, clock_ticks + msg.duration);
+	send_midi_message(out);
+
+	if (record) {
+		status = disable_interrupt();						// Shares the pattern with the receive interrupt
+		channels_used |= 1 << (msg.command & 0xF);
+		save_message(msg);
+		restore_interrupt(status);
+	}
+}
+
+// Stops the timer and displays current state
+void stop_playback() {
+	play = 0;
+	release_all_held();
+	erase_count = 0;
+	T2CON &= ~0x8000;		// Timer off
+	idle_paused(1);
+	if (clock_out) {
+		midi_realtime(MIDI_STOP);
+	}
+	if (record) {														// Notes are entered on the step shown
+		display_string_int(3, "Step", current_column + 1);
+	} else {
 		display_string(3, "Paused");
 		display_update();
-		all_notes_off();
+	}
+	all_notes_off();
+}
+
+/*
+	Moves the step notes are entered on while paused with record on, one
+	forward or back, and the tracks with their own length along with it.
+	Moving forward ties the notes of the keys still down.
+*/
+void move_edit_step(int direction) {
+	if (direction > 0) {
+		stepedit_tie();
+		if (++current_column >= current_pattern->length) {
+			current_column = 0;
+		}
+		track_step(current_pattern, current_column);
 	} else {
-		play = 1;
-		display_string(3, "Playing");
-		display_update();
-		T2CON |= 0x8000;		// Timer on
+		stepedit_release();
+		if (--current_column < 0) {
+			current_column = current_pattern->length - 1;
+		}
+		track_step_back(current_pattern);
+	}
+	show_step(-1);
+	display_string_int(3, "Step", current_column + 1);
+}
+
+// Starts the timer from the first column or from where it stopped
+void start_playback(int from_start) {
+	play = 1;
+	stepedit_release();
+	idle_paused(0);
+	time_counter = CLOCKS_PER_STEP - 1;	// Next column plays on the first clock
+	if (from_start) {
+		current_column = current_pattern->length - 1;	// Next step wraps into the first column
+		steps_played = 0;
+		track_restart(current_pattern, 0);
+		trig_restart();
+		if (clock_out) {
+			midi_realtime(MIDI_START);
+		}
+	} else if (clock_out) {						// Resume where we stopped
+		midi_song_position(steps_played);
+		midi_flush();										// Position must arrive before continue
+		midi_realtime(MIDI_CONTINUE);
+	}
+	display_string(3, song_active ? "Playing song" : "Playing");
+	display_update();
+	sync_start();
+	T2CON |= 0x8000;		// Timer on
+}
+
+// Toggles playback, with the record switch up a song starts from its first entry
+void play_pause() {
+	if (play) {
+		stop_playback();
+	} else if (record && song_length > 0) {
+		song_start();
+		start_playback(1);
+	} else {
+		start_playback(0);
+	}
+}
+
+// Follows start, continue, stop and song position sent by the clock master
+void handle_remote() {
+	int command = remote_command;
+	int position = remote_position;
+	remote_command = 0;
+	remote_position = -1;
+
+	if (position >= 0 && !play) {
+		steps_played = position;
+		current_column = position % current_pattern->length - 1;	// Next step plays the position
+		if (current_column < 0) {
+			current_column = current_pattern->length - 1;
+		}
+		track_restart(current_pattern, position);
+	}
+	if (command == MIDI_STOP && play) {
+		stop_playback();
+	} else if (command == MIDI_START && !play) {
+		if (song_active) {
+			song_start();
+		}
+		start_playback(1);
+	} else if (command == MIDI_CONTINUE && !play) {
+		start_playback(0);
+	}
+}
+
+// Starts a new undo history from the state of the playing pattern
+void reset_undo() {
+	int i;
+	undo_index = 0;
+	for (i = 0; i < COLUMNS; i++) {
+		prev_column_lengths[0][i] = current_pattern->column_lengths[i];
 	}
 }
 
+// Shows the playing pattern, and the queued one while a switch is pending
+void display_pattern() {
+	static const char label[] = "Pattern ";
+	char *s = textbuffer[0];
+	int col;
+	for (col = 16; col < TEXT_COLUMNS; col++) {	// The condensed half of the row
+		s[col] = (col - 16 < sizeof(label) - 1) ? label[col - 16] : ' ';
+	}
+	col = display_number(0, 16 + sizeof(label) - 1, pattern_index(current_pattern) + 1);
+	if (queued_pattern != pattern_index(current_pattern)) {
+		s[col + 1] = '>';
+		display_number(0, col + 3, queued_pattern + 1);
+	}
+}
+
+// Shows the undo step and pattern on the first row
+void display_saved() {
+	roll_stale = 1;												// Called whenever the pattern changed
+	display_string(0, "Saved:");
+	display_int_indented(0, undo_index);
+	display_pattern();
+	display_update();
+}
+
 // Reverts column_lengths to previous saved state
 void undo() {
 	if (!notes_recorded() && undo_index > 0) {
 		undo_index--;
 	}
-	int i, j;
+	int i;
+	stepedit_release();
 	for (i = 0; i < COLUMNS; i++) {
-		column_lengths[i] = prev_column_lengths[undo_index][i];
+		pattern_truncate(current_pattern, i, prev_column_lengths[undo_index][i]);
 	}
 	all_notes_off();
-	highest_note = 0;
-	lowest_note = 127;
-	for (i = 0; i < COLUMNS; i++) {	// Look up new highest/lowest note
-		for (j = 0; j < column_lengths[i]; j++) {
-			unsigned char note = messages[i][j].note;
-			if (note > highest_note) {
-				highest_note = note;
-			}
-			if (note < lowest_note) {
-				lowest_note = note;
-			}
-		}
-	}
-	display_string_int(0, "Saved:", undo_index);
+	storage_mark_all_dirty(pattern_index(current_pattern));
+	storage_save();
+	display_saved();
 }
 
-// Clear all recorded notes, saves and resets the highest/lowest note
+// Clear all recorded notes of the playing pattern and its saves
 void clear() {
-	clear_column_array(column_lengths);
+	int i;
+	if (record && !play) {					// Paused with record on clears the song instead
+		song_clear();
+		display_string(2, "Song cleared");
+		display_update();
+		return;
+	}
+	stepedit_release();
+	for (i = 0; i < COLUMNS; i++) {
+		pattern_truncate(current_pattern, i, 0);
+		prev_column_lengths[0][i] = 0;
+	}
 	all_notes_off();
 	undo_index = 0;
-	highest_note = 0;
-	lowest_note = 127;
-	display_string_int(0, "Saved:", undo_index);
+	storage_mark_all_dirty(pattern_index(current_pattern));
+	storage_save();
+	display_saved();
 }
 
 // Saves column_lengths if new notes has been recorded since last save
@@ -297,11 +867,12 @@ void save_column_lengths() {
 		}
 		int i;
 		for (i = 0; i < COLUMNS; i++) {
-			prev_column_lengths[undo_index][i] = column_lengths[i];
+			prev_column_lengths[undo_index][i] = current_pattern->column_lengths[i];
 		}
 		display_string(2, "");								// Clear "recording" from display
-		display_string_int(0, "Saved:", undo_index);
+		display_saved();
 	}
+	storage_save();													// Persist recorded and transposed columns
 }
 
 // Handles the functionallity for all buttons and switches
@@ -309,8 +880,14 @@ void handle_input() {
 	int new_record = get_sw() & (1 << 2);
 	int new_btns = get_btns();
 
+	thru_enabled = get_sw() & 1;
+
 	if (!(btns & 1) && (new_btns & 1)) {			// Transpose pushed down
-		transpose();
+		if (record && !play) {
+			move_edit_step((get_sw() & 2) ? 1 : -1);	// Paused with record on moves the step instead
+		} else {
+			transpose();
+		}
 	}
 
 	if (!(btns & 2) && (new_btns & 2)) {			// Play/Pause pushed down
@@ -326,85 +903,213 @@ void handle_input() {
 	}
 
 	if (record && !new_record) {							// Record switch flipped down
+		release_all_held();
+		erase_count = 0;
+		stepedit_release();
 		save_column_lengths();
+		if (!play) {
+			display_string(3, "Paused");
+			display_update();
+		}
 	}
 
 	if (!record && new_record) {							// Record switch flipped up
 		display_string(2, "Recording");
+		if (!play) {
+			display_string_int(3, "Step", current_column + 1);
+		}
 		display_update();
 	}
 
+	int record_changed = !record != !new_record;
 	btns = new_btns;
 	record = new_record;
+	if (record_changed && !play) {
+		show_step(-1);												// Playing picks it up at the next step
+	}
 }
 
 // Reads the potentiometer and adjusts the tempo accordingly
 void update_tempo() {
 	/* Start sampling potentiometer, wait until conversion is done */
+	unsigned int start = read_core_timer();
 	AD1CON1 |= (0x1 << 1);
-	while(!(AD1CON1 & (0x1 << 1)));
-	while(!(AD1CON1 & 0x1));
+	while(!(AD1CON1 & (0x1 << 1)) || !(AD1CON1 & 0x1)) {
+		if (read_core_timer() - start > ADC_TIMEOUT_US * CORE_TIMER_US) {
+			diag_state.adc_timeouts++;				// Keep the old tempo
+			return;
+		}
+	}
+
+	/* Get the analog value and update the tempo, 40 - 295 BPM */
+	unsigned int value = ADC1BUF0 >> 2;
+	if (clock_locked) {									// The external clock sets the tempo
+		tempo = sync_tempo();
+	} else if (value + 40 != tempo) {
+		tempo = value + 40;
+		next_period = TIMER2_HZ * 60 / (tempo * CLOCKS_PER_STEP * 4) - 1;
+	}
 
-	/* Get the analog value and update beat_length */
-	unsigned int value = (ADC1BUF0 >> 5);
-	beat_length = 32 - value;
+	if (clock_locked) {
+		display_string(1, "Sync:");
+		display_tenths(1, 7, sync_tempo_tenths());
+	} else {
+		display_string(1, "Tempo:");
+		display_int_indented(1, tempo);
+	}
+	if (diag_state.step_overruns != shown_overruns) {	// Notes were left out lately
+		shown_overruns = diag_state.step_overruns;
+		overrun_timer = OVERRUN_SHOWN;
+	}
+	if (overrun_timer > 0) {
+		overrun_timer--;
+		textbuffer[1][15] = '!';
+	}
+	display_update();
+}
+
+/*
+	Moves to the next column and plays it, switching to the queued pattern
+	when the loop ends. Called from the main loop for every step's worth
+	of clock ticks.
+*/
+void play_step() {
+	unsigned int status = disable_interrupt();
+	time_counter -= CLOCKS_PER_STEP;	// Keep ticks that came while the loop was busy
+	unsigned int step_tick = clock_ticks - time_counter;	// When this step started
+	restore_interrupt(status);
+	steps_played++;
+
+	/* Increment the current column and wrap around at end of matrix */
+	int switched = 0;
+	if (++current_column >= current_pattern->length) {	// Compare, the length may just have shrunk
+		current_column = 0;
+		if (pattern_index(current_pattern) != queued_pattern) {
+			current_pattern = &patterns[queued_pattern];	// Switch without copying events
+			pattern_index_notes();
+			switched = 1;
+			track_restart(current_pattern, 0);
+			trig_restart();
+		}
+		trig_loop();
+	}
+	track_step(current_pattern, current_column);
 
-	PORTE = 1 << (7 - current_column % 8); // Flash the current tempo on the LEDs
+	show_step(-1);								// Before the first byte of the step
 
-	display_string_int(1, "Tempo:", (33 - beat_length));
+	/* If switch 4 if up play metronome */
+	if ((current_column & 3) == 0) {
+		if (get_sw() & (1 << 3)) {
+			metronome();
+		}
+	}
+
+	if (erase_count && record) {
+		erase_held_keys();						// Before the step, so the erased notes don't sound
+	}
+	play_column(step_tick);
+
+	fix_previous_column();
+
+	/* In song mode the next pattern is picked while the last column plays */
+	if (song_active && current_column == current_pattern->length - 1) {
+		queued_pattern = pattern_index(song_next());
+	}
+
+	if (switched) {								// Bookkeeping after the column went out
+		reset_undo();
+		display_saved();
+	}
 }
 
-int main(void) {
-	quicksleep(10000000);
+/*
+	Brings up the board, restores the saved patterns and starts playing.
+	Nothing here waits for the display, which powers up in the background
+	from display_poll, so the first MIDI byte goes out right away.
+*/
+void boot() {
+	pattern_init();												// Before interrupts can record into the pool
 	init();
-	clear_column_array(column_lengths);
-	clear_column_array(prev_column_lengths[0]);
+	diag_report();												// Crash before the last reset, if any
+	storage_load();												// Restore the patterns saved before power off
+	find_channels_used();
+	reset_undo();
 
 	// Initialise display message
-	display_string_int(0, "Saved:", undo_index);
-
+	display_condensed(0, 1);							// Room for both pattern numbers in full
+	display_saved();
 
+	time_counter = CLOCKS_PER_STEP - 1;	// First column plays on the first clock
+	if (clock_out) {
+		midi_realtime(MIDI_START);
+	}
 	T2CON |= 0x8000;		// Timer on
 	display_string(3, "Playing");
 	display_update();
+	watchdog_init();
+}
+
+int main(void) {
+	boot();
+	int shown_pattern = queued_pattern;
+	int roll_shown = 0;
 
 	for (;;) {
+		noteoff_service(clock_ticks);						// Before a step that may start the same notes
 
-		if (time_counter > beat_length) {
-			time_counter = 0;
+		if (time_counter >= CLOCKS_PER_STEP) {
+			play_step();
+		}
+		if (arp_mode && play) {
+			play_arp();
+		}
+		if (time_counter < CLOCKS_PER_STEP) {			// No step left due, also when paused
+			watchdog_checkin(TASK_STEP);
+		}
+		handle_input();
 
-			/* Increment the current column and wrap around at end of matrix */
-			if (++current_column == COLUMNS) {
-				current_column = 0;
-			}
+		if (remote_command || remote_position >= 0) {
+			handle_remote();
+		}
+		watchdog_checkin(TASK_INPUT);
+		sync_poll();
 
-			/* If switch 4 if up play metronome */
-			if (current_column % 4 == 0) {
-				if (get_sw() & (1 << 3)) {
-					metronome();
-				}
+		if (shown_pattern != queued_pattern) {	// Program change received
+			shown_pattern = queued_pattern;
+			display_saved();
+		}
+		if (roll_view != roll_shown) {
+			roll_shown = roll_view;
+			display_graphics(roll_view);			// Back to text redraws every cell
+			if (roll_view) {
+				fb_invalidate();
+				roll_stale = 1;
 			}
-
-			/* For loop to go trough all rows in current column */
-			int i;
-			for (i = 0; i < column_lengths[current_column]; i++) {
-				struct message msg = messages[current_column][i];
-				if (msg.enable) {
-					send_midi_message(msg);
-				} else {
-					messages[current_column][i].enable = 1;
-				}
+		}
+		if (roll_view) {
+			if (roll_stale) {
+				roll_stale = 0;
+				pianoroll_draw(current_pattern);
 			}
-
-			fix_previous_column();
+			pianoroll_playhead(current_column, current_pattern->length);
+			fb_flush();								// Polls the display itself
+		} else {
+			display_poll();
 		}
-		handle_input();
+		watchdog_checkin(TASK_DISPLAY);
 
 		if (tempo_timer > 5) {
 			tempo_timer = 0;
 			update_tempo();
 		}
+		if (tempo_timer <= 5) {									// Not due, Timer2 stops when paused
+			watchdog_checkin(TASK_TEMPO);
+		}
 
+		unsigned int status = disable_interrupt();	// Nothing may come between the check and the wait
+		idle(time_counter < CLOCKS_PER_STEP && tempo_timer <= 5 &&
+			!remote_command && remote_position < 0);
+		restore_interrupt(status);
 	}
 
 	return 0;
@@ -0,0 +1,320 @@
+/* midi.c
+   MIDI output through UART1.
+
+   Channel messages go through a queue that the UART transmit interrupt
+   drains. The interrupt fires when the transmit FIFO is empty and moves one
+   byte at a time, so at most one queued byte ever waits in hardware. A
+   real-time byte (timing clock, start, stop) skips the queue: it goes
+   straight into the FIFO when there is room, otherwise it waits in a
+   small queue of its own that the interrupt empties before anything else.
+   MIDI allows real-time bytes between the bytes of other messages, so
+   this never breaks a message.
+
+   The receive interrupt only moves bytes from the UART to a queue and
+   handles real-time bytes, which are timestamped the moment they arrive,
+   even in the middle of a message. The rest is parsed a byte at a time
+   with running status in core software interrupt 0, at a lower priority
+   so the clock tick can always get in.
+
+   MIDI thru does not wait for whole messages. Each incoming byte that
+   passes the thru filter is put in a thru queue as soon as it arrives, and
+   the transmit interrupt takes thru bytes before sequenced ones whenever
+   the output is between two sequenced messages. Once a thru message has
+   started going out the output waits for the rest of it, so the two
+   streams only ever merge at message boundaries. Note messages are held
+   back until their note number has arrived so the note range can be
+   checked, which costs one byte time. */
+
+#include <pic32mx.h>
+#include "arp.h"
+#include "diag.h"
+#include "init.h"
+#include "midi.h"
+#include "sync.h"
+
+#define TX_QUEUE_SIZE 256							// Power of two, indices wrap by masking
+#define THRU_QUEUE_SIZE 64						// Power of two, indices wrap by masking
+#define RX_QUEUE_SIZE 64							// Power of two, indices wrap by masking
+#define REALTIME_QUEUE_SIZE 4						// Power of two, indices wrap by masking
+#define U1TX_IRQ (1 << 28)
+#define CS0_IRQ (1 << 1)
+#define BYTE_US 320										// One byte on the wire at 31250 baud
+#define TX_STALL_US (32 * BYTE_US)					// A working UART frees a place well before this
+
+int clock_out = 1;
+int thru_enabled = 0;
+int thru_channel = -1;							// Output channel for thru, -1 keeps the input channel
+int thru_note_low = 0;							// Notes outside low - high are not passed thru
+int thru_note_high = 127;
+
+static unsigned char tx_queue[TX_QUEUE_SIZE];
+static volatile unsigned int tx_head = 0;		// Next byte to send
+static volatile unsigned int tx_tail = 0;		// Next free place
+static unsigned char realtime_queue[REALTIME_QUEUE_SIZE];	// Real-time bytes waiting for the FIFO
+static unsigned int realtime_head = 0;
+static unsigned int realtime_tail = 0;
+static int tx_remaining = 0;								// Data bytes left of the sequenced message being sent, -1 in SysEx
+
+static unsigned char thru_queue[THRU_QUEUE_SIZE];
+static volatile unsigned int thru_head = 0;
+static volatile unsigned int thru_tail = 0;
+static int thru_incomplete = 0;							// 1 while a thru message is only partly queued
+static int thru_passing = 0;								// 1 when the message being received goes thru
+static int thru_dropping = 0;								// 1 while the rest of a given up thru message is dropped
+
+static unsigned char rx_queue[RX_QUEUE_SIZE];
+static volatile unsigned int rx_head = 0;		// Next byte to parse
+static volatile unsigned int rx_tail = 0;		// Next free place
+
+static unsigned char rx_status = 0;					// Running status, 0 when data is ignored
+static unsigned char rx_data[2];
+static int rx_count = 0;										// Data bytes received for rx_status
+static int rx_length = 0;										// Data bytes rx_status takes
+
+/* Number of data bytes after a status byte, -1 for those whose data is ignored */
+static int message_length(unsigned char status) {
+	switch (status & 0xF0) {
+		case 0xC0:
+		case 0xD0:
+			return 1;
+		case 0xF0:
+			if (status == 0xF1 || status == 0xF3) {
+				return 1;
+			}
+			return (status == MIDI_SONG_POSITION) ? 2 : -1;
+		default:
+			return 2;
+	}
+}
+
+/*
+	Moves one byte to the UART, called with interrupts disabled. With
+	may_wait cleared a half sent thru message is given up rather than waited
+	for, which is needed when the caller keeps the receive interrupt out.
+	The rest of a given up message is dropped, sent after the sequenced
+	message it would be read under the wrong status.
+*/
+static void tx_next(int may_wait) {
+	if (realtime_head != realtime_tail) {
+		U1TXREG = realtime_queue[realtime_head];
+		realtime_head = (realtime_head + 1) & (REALTIME_QUEUE_SIZE - 1);
+	} else if (tx_remaining == 0 && thru_head != thru_tail) {	// Thru first, at message boundaries
+		U1TXREG = thru_queue[thru_head];
+		thru_head = (thru_head + 1) & (THRU_QUEUE_SIZE - 1);
+	} else if (tx_remaining == 0 && thru_incomplete && may_wait) {
+		IECCLR(0) = U1TX_IRQ;							// Rest of the thru message comes with the next byte in
+	} else if (tx_head != tx_tail) {
+		unsigned char byte = tx_queue[tx_head];
+		tx_head = (tx_head + 1) & (TX_QUEUE_SIZE - 1);
+		U1TXREG = byte;
+		if (!may_wait && thru_incomplete) {
+			thru_incomplete = 0;
+			thru_dropping = 1;
+		}
+		if (byte == 0xF0) {
+			tx_remaining = -1;
+		} else if (byte & 0x80) {
+			tx_remaining = (message_length(byte) < 0) ? 0 : message_length(byte);
+		} else if (tx_remaining > 0) {
+			tx_remaining--;
+		}
+	} else {
+		IECCLR(0) = U1TX_IRQ;							// Nothing left, wait for more data
+	}
+}
+
+void midi_tx_isr() {
+	unsigned int status = disable_interrupt();	// The clock tick may send too
+	tx_next(1);
+	IFSCLR(0) = U1TX_IRQ;
+	restore_interrupt(status);
+}
+
+static void thru_byte(unsigned char byte) {
+	unsigned int next = (thru_tail + 1) & (THRU_QUEUE_SIZE - 1);
+	if (next != thru_head) {						// Input and output run at the same rate, full means stuck
+		thru_queue[thru_tail] = byte;
+		thru_tail = next;
+	}
+	IECSET(0) = U1TX_IRQ;
+}
+
+/*
+	Queues a byte. When the queue is full the caller sends bytes itself, so
+	this also works from interrupt handlers where the transmit interrupt
+	cannot run. Interrupts are let in between tries. If the UART stops
+	taking bytes the byte is dropped and counted.
+*/
+void midi_send_byte(unsigned char byte) {
+	unsigned int start = read_core_timer();
+	unsigned int status = disable_interrupt();
+	while (((tx_tail + 1) & (TX_QUEUE_SIZE - 1)) == tx_head) {
+		if (!(U1STA & PIC32_USTA_UTXBF)) {
+			tx_next(0);
+		}
+		restore_interrupt(status);
+		if (read_core_timer() - start > TX_STALL_US * CORE_TIMER_US) {
+			diag_state.tx_timeouts++;
+			return;
+		}
+		status = disable_interrupt();
+	}
+	tx_queue[tx_tail] = byte;
+	tx_tail = (tx_tail + 1) & (TX_QUEUE_SIZE - 1);
+	IECSET(0) = U1TX_IRQ;
+	restore_interrupt(status);
+}
+
+/* Send MIDI message */
+void send_midi_message(struct message msg) {
+	diag_note(msg.command, msg.note, msg.velocity);
+	midi_send_byte(msg.command);
+	midi_send_byte(msg.note);
+	midi_send_byte(msg.velocity);
+}
+
+// Bytes queued for the output, including thru
+int midi_queued() {
+	return ((tx_tail - tx_head) & (TX_QUEUE_SIZE - 1)) + ((thru_tail - thru_head) & (THRU_QUEUE_SIZE - 1));
+}
+
+/*
+	Sends a real-time byte ahead of everything queued. A clock tick can
+	come while a stop or start still waits for the FIFO, so a few wait in
+	order. Only a UART that stopped taking bytes fills them, then the byte
+	is dropped and counted.
+*/
+void midi_realtime(unsigned char byte) {
+	unsigned int status = disable_interrupt();
+	unsigned int next = (realtime_tail + 1) & (REALTIME_QUEUE_SIZE - 1);
+	if (realtime_head == realtime_tail && !(U1STA & PIC32_USTA_UTXBF)) {
+		U1TXREG = byte;
+	} else if (next != realtime_head) {
+		realtime_queue[realtime_tail] = byte;
+		realtime_tail = next;
+		IECSET(0) = U1TX_IRQ;
+	} else {
+		diag_state.tx_timeouts++;
+	}
+	restore_interrupt(status);
+}
+
+// Song position in sixteenth notes, which is one step
+void midi_song_position(int steps) {
+	midi_send_byte(MIDI_SONG_POSITION);
+	midi_send_byte(steps & 0x7F);
+	midi_send_byte((steps >> 7) & 0x7F);
+}
+
+// Waits until every queued byte has been handed to the UART
+void midi_flush() {
+	unsigned int start = read_core_timer();
+	while (tx_head != tx_tail) {
+		if (read_core_timer() - start > (TX_QUEUE_SIZE * BYTE_US + TX_STALL_US) * CORE_TIMER_US) {
+			diag_state.tx_timeouts++;
+			return;
+		}
+	}
+}
+
+/*
+	Thru for one data byte of a channel message, count is its place in the
+	message. The status goes out with the first data byte, also when the
+	sender used running status, since sequenced messages may come between.
+*/
+static void thru_data(unsigned char status, unsigned char byte, int count) {
+	if (count == 0) {
+		int type = status & 0xF0;
+		thru_dropping = 0;
+		thru_passing = thru_enabled;
+		if ((type == 0x80 || type == 0x90 || type == 0xA0) &&
+				(byte < thru_note_low || byte > thru_note_high)) {
+			thru_passing = 0;
+		}
+		if ((type == 0x80 || type == 0x90) && arp_mode) {
+			thru_passing = 0;										// The arpeggiator plays them
+		}
+		if (thru_passing) {
+			thru_byte(thru_channel < 0 ? status : (type | thru_channel));
+		}
+	}
+	if (thru_dropping) {
+		thru_passing = 0;
+	}
+	if (thru_passing) {
+		thru_incomplete = (count + 1 < rx_length);
+		thru_byte(byte);
+	}
+}
+
+static void rx_byte(unsigned char byte) {
+	if (byte & 0x80) {
+		rx_length = message_length(byte);
+		rx_status = (rx_length < 0) ? 0 : byte;
+		rx_count = 0;
+		thru_incomplete = 0;										// A message cut short is not waited for
+		return;
+	}
+	if (!rx_status) {
+		return;
+	}
+	if (rx_status < 0xF0) {
+		unsigned int status = disable_interrupt();	// Keeps the thru queue and its flag together
+		thru_data(rx_status, byte, rx_count);
+		restore_interrupt(status);
+	}
+	rx_data[rx_count++] = byte;
+	if (rx_count == rx_length) {
+		midi_message_received(rx_status, rx_data[0], rx_length > 1 ? rx_data[1] : 0);
+		rx_count = 0;
+		if (rx_status >= 0xF0) {								// System messages have no running status
+			rx_status = 0;
+		}
+	}
+}
+
+void midi_rx_isr() {
+	while (U1STA & PIC32_USTA_URXDA) {
+		unsigned char byte = U1RXREG & 0xFF;
+		if (byte >= 0xF8) {											// Real-time, may come anywhere
+			unsigned int status = disable_interrupt();	// Steering reads Timer2 state
+			sync_realtime(byte);
+			restore_interrupt(status);
+		} else {
+			unsigned int next = (rx_tail + 1) & (RX_QUEUE_SIZE - 1);
+			if (next != rx_head) {
+				rx_queue[rx_tail] = byte;
+				rx_tail = next;
+			}
+		}
+	}
+	U1STACLR = PIC32_USTA_OERR;									// An overrun stops reception until cleared
+	IFSCLR(0) = 1 << 27;
+	if (rx_head != rx_tail) {
+		set_soft_interrupt(1);
+	}
+}
+
+/* UART1 vector, receive and transmit share it */
+void midi_uart_isr() {
+	ISR_PROFILE_ENTRY(ISR_SOURCE_UART1);
+	if (IFS(0) & (1 << 27)) {
+		midi_rx_isr();
+	}
+	if (IFS(0) & U1TX_IRQ) {
+		midi_tx_isr();
+	}
+	ISR_PROFILE_EXIT(ISR_SOURCE_UART1);
+}
+
+/* Core software interrupt 0, parses what the receive interrupt queued */
+void midi_parse_isr() {
+	ISR_PROFILE_ENTRY(ISR_SOURCE_PARSE);
+	set_soft_interrupt(0);											// Cleared first, bytes may come in meanwhile
+	IFSCLR(0) = CS0_IRQ;
+	while (rx_head != rx_tail) {
+		rx_byte(rx_queue[rx_head]);
+		rx_head = (rx_head + 1) & (RX_QUEUE_SIZE - 1);
+	}
+	ISR_PROFILE_EXIT(ISR_SOURCE_PARSE);
+}
@@ -0,0 +1,38 @@
+/* midi.h
+   MIDI output through UART1. */
+
+#ifndef MIDI_H
+#define MIDI_H
+
+#include "sequencer.h"
+
+#define MIDI_CLOCK 0xF8
+#define MIDI_START 0xFA
+#define MIDI_CONTINUE 0xFB
+#define MIDI_STOP 0xFC
+#define MIDI_SONG_POSITION 0xF2
+
+#define CLOCKS_PER_STEP 6		// 24 PPQN clock, four steps per beat
+#define MIDI_BYTES_PER_SECOND 3125	// 31250 baud, ten bits a byte
+
+extern int clock_out;				// 1 to send timing clock while playing
+extern int thru_enabled;			// 1 to pass channel messages from the input to the output
+extern int thru_channel;
+extern int thru_note_low;
+extern int thru_note_high;
+
+void send_midi_message(struct message msg);
+void midi_send_byte(unsigned char byte);
+void midi_realtime(unsigned char byte);
+void midi_song_position(int steps);
+void midi_flush(void);
+int midi_queued(void);
+void midi_tx_isr(void);
+void midi_rx_isr(void);
+void midi_uart_isr(void);
+void midi_parse_isr(void);
+
+/* Implemented by the sequencer, called from the receive interrupt */
+void midi_message_received(unsigned char status, unsigned char data1, unsigned char data2);
+
+#endif
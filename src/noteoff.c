@@ -0,0 +1,104 @@
+/* noteoff.c
+   Note offs scheduled from the durations of played notes.
+
+   Playback sends only note ons; each one schedules its note off here for
+   the clock tick its duration ends on. The pending note offs are a binary
+   min-heap on that tick, so the main loop finds the next one due in
+   constant time and sends what is due on every tick it wakes for.
+
+   A note that starts again while it still sounds gets its pending note
+   off at once, so every note on is matched by exactly one note off. When
+   the heap is full the note off due first is sent early to make room.
+   Ticks wrap, they are compared by their difference. */
+
+#include "midi.h"
+#include "noteoff.h"
+
+struct noteoff {
+	unsigned int due;										// Clock tick to send the note off on
+	unsigned char channel;
+	unsigned char note;
+};
+
+static struct noteoff heap[NOTEOFF_SLOTS];
+static int pending = 0;
+
+static int before(int a, int b) {
+	return (int) (heap[a].due - heap[b].due) < 0;
+}
+
+static void swap(int a, int b) {
+	struct noteoff t = heap[a];
+	heap[a] = heap[b];
+	heap[b] = t;
+}
+
+static void sift_up(int i) {
+	while (i > 0 && before(i, (i - 1) / 2)) {
+		swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void sift_down(int i) {
+	for (;;) {
+		int child = 2 * i + 1;
+		if (child >= pending) {
+			return;
+		}
+		if (child + 1 < pending && before(child + 1, child)) {
+			child++;
+		}
+		if (!before(child, i)) {
+			return;
+		}
+		swap(i, child);
+		i = child;
+	}
+}
+
+// Sends the note off in slot i and takes it out of the heap
+static void send(int i) {
+	struct message msg = {0x80 | heap[i].channel, heap[i].note, 0, 0};
+	send_midi_message(msg);
+	heap[i] = heap[--pending];
+	if (i < pending) {
+		sift_down(i);
+		sift_up(i);
+	}
+}
+
+/*
+	Schedules the note off for a note about to start on an output channel,
+	called before its note on is sent
+*/
+void noteoff_start(unsigned char channel, unsigned char note, unsigned int due) {
+	int i;
+	for (i = 0; i < pending; i++) {
+		if (heap[i].channel == channel && heap[i].note == note) {
+			send(i);												// Still sounding, end it first
+			break;
+		}
+	}
+	if (pending == NOTEOFF_SLOTS) {
+		send(0);
+	}
+	heap[pending].due = due;
+	heap[pending].channel = channel;
+	heap[pending].note = note;
+	sift_up(pending++);
+}
+
+// Sends every note off due by now, called from the main loop
+void noteoff_service(unsigned int now) {
+	while (pending > 0 && (int) (heap[0].due - now) <= 0) {
+		send(0);
+	}
+}
+
+// Sends every pending note off now, for when all notes are turned off
+void noteoff_flush() {
+	while (pending > 0) {
+		send(pending - 1);							// The last slot, nothing to sift
+	}
+}
@@ -0,0 +1,13 @@
+/* noteoff.h
+   Note offs scheduled from the durations of played notes. */
+
+#ifndef NOTEOFF_H
+#define NOTEOFF_H
+
+#define NOTEOFF_SLOTS 32								// Notes that can sound at once
+
+void noteoff_start(unsigned char channel, unsigned char note, unsigned int due);
+void noteoff_service(unsigned int now);
+void noteoff_flush(void);
+
+#endif
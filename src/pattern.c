@@ -0,0 +1,180 @@
+/* pattern.c
+   Pattern bank and the event pool shared by all patterns.
+
+   Free events are kept on a list threaded through the pool. Both the MIDI
+   receive interrupt and the main loop change the lists, so every change is
+   made with interrupts disabled.
+
+   For the playing pattern each column also has a word with a bit for
+   every pitch in it, folded to 32 pitches, so looking for a note in a
+   column is one test unless a note 32 semitones away is there too. Only
+   the columns of one pattern are indexed to keep it small, and the index
+   is rebuilt when the pattern switches. */
+
+#include "init.h"
+#include "sequencer.h"
+
+struct event events[POOL_SIZE];
+struct pattern patterns[PATTERNS];
+struct pattern *current_pattern = &patterns[0];
+int queued_pattern = 0;
+
+static unsigned short free_events;				// First event of the free list
+static unsigned int note_bits[COLUMNS];		// Pitches in each column of current_pattern, modulo 32
+
+static unsigned int note_bit(unsigned char note) {
+	return 1u << (note & 31);
+}
+
+// Indexes the pitches of one column of the playing pattern again
+static void index_column(struct pattern *p, int column) {
+	unsigned int bits = 0;
+	unsigned short e;
+	if (p != current_pattern) {
+		return;
+	}
+	for (e = p->first[column]; e != NO_EVENT; e = events[e].next) {
+		bits |= note_bit(events[e].msg.note);
+	}
+	note_bits[column] = bits;
+}
+
+void pattern_init() {
+	int i, j;
+	for (i = 0; i < POOL_SIZE - 1; i++) {
+		events[i].next = i + 1;
+	}
+	events[POOL_SIZE - 1].next = NO_EVENT;
+	free_events = 0;
+
+	for (i = 0; i < PATTERNS; i++) {
+		patterns[i].length = DEFAULT_LENGTH;
+		for (j = 0; j < COLUMNS; j++) {
+			patterns[i].first[j] = NO_EVENT;
+			patterns[i].last[j] = NO_EVENT;
+			patterns[i].column_lengths[j] = 0;
+		}
+		for (j = 0; j < TRACKS; j++) {
+			patterns[i].track_lengths[j] = 0;
+		}
+	}
+	current_pattern = &patterns[0];
+	queued_pattern = 0;
+}
+
+// Indexes the pitches of the playing pattern, after it switched or its notes moved
+void pattern_index_notes() {
+	int i;
+	unsigned int status = disable_interrupt();
+	for (i = 0; i < COLUMNS; i++) {
+		index_column(current_pattern, i);
+	}
+	restore_interrupt(status);
+}
+
+// Returns 0 if column of the playing pattern has no note of this pitch, 1 if it may
+int pattern_may_hold(int column, unsigned char note) {
+	return (note_bits[column] & note_bit(note)) != 0;
+}
+
+int pattern_index(struct pattern *p) {
+	return p - patterns;
+}
+
+// Adds msg to the end of column, returns 0 if the column or the pool is full
+int pattern_append(struct pattern *p, int column, struct message msg) {
+	unsigned int status = disable_interrupt();
+	unsigned short e = free_events;
+	if (e == NO_EVENT || p->column_lengths[column] >= ROWS) {
+		restore_interrupt(status);
+		return 0;
+	}
+	free_events = events[e].next;
+
+	events[e].msg = msg;
+	events[e].next = NO_EVENT;
+	if (p->last[column] == NO_EVENT) {
+		p->first[column] = e;
+	} else {
+		events[p->last[column]].next = e;
+	}
+	p->last[column] = e;
+	p->column_lengths[column]++;
+	if (p == current_pattern) {
+		note_bits[column] |= note_bit(msg.note);
+	}
+	restore_interrupt(status);
+	return 1;
+}
+
+// Unlinks e from column and frees it, prev is the event before e or NO_EVENT
+void pattern_remove(struct pattern *p, int column, unsigned short prev, unsigned short e) {
+	unsigned int status = disable_interrupt();
+	if (prev == NO_EVENT) {
+		p->first[column] = events[e].next;
+	} else {
+		events[prev].next = events[e].next;
+	}
+	if (p->last[column] == e) {
+		p->last[column] = prev;
+	}
+	p->column_lengths[column]--;
+
+	events[e].next = free_events;
+	free_events = e;
+	index_column(p, column);
+	restore_interrupt(status);
+}
+
+// Frees every message of column after the first length ones
+void pattern_truncate(struct pattern *p, int column, int length) {
+	unsigned int status = disable_interrupt();
+	if (length < p->column_lengths[column]) {
+		unsigned short prev = NO_EVENT;
+		unsigned short e = p->first[column];
+		int i;
+		for (i = 0; i < length; i++) {
+			prev = e;
+			e = events[e].next;
+		}
+		if (prev == NO_EVENT) {
+			p->first[column] = NO_EVENT;
+		} else {
+			events[prev].next = NO_EVENT;
+		}
+		p->last[column] = prev;
+		p->column_lengths[column] = length;
+
+		while (e != NO_EVENT) {					// Return the tail to the free list
+			unsigned short next = events[e].next;
+			events[e].next = free_events;
+			free_events = e;
+			e = next;
+		}
+		index_column(p, column);
+	}
+	restore_interrupt(status);
+}
+
+// Sets the number of columns played, messages past the end are kept
+void pattern_set_length(struct pattern *p, int length) {
+	if (length < 1) {
+		length = 1;
+	} else if (length > COLUMNS) {
+		length = COLUMNS;
+	}
+	p->length = length;
+}
+
+// Gives the notes of channel their own number of columns, 0 follows the pattern length
+void pattern_set_track_length(struct pattern *p, int channel, int length) {
+	if (length < 0) {
+		length = 0;
+	} else if (length > COLUMNS) {
+		length = COLUMNS;
+	}
+	if (length > TRACK_LENGTH_MAX) {
+		length = TRACK_LENGTH_MAX;
+	}
+	p->track_lengths[channel] = length;
+}
@@ -0,0 +1,107 @@
+/* pianoroll.c
+   Piano roll view of a pattern on the framebuffer.
+
+   Time runs left to right over the pattern length, so a step is several
+   pixels wide in short patterns and shares a pixel with its neighbours in
+   long ones. Pitch runs bottom to top over the notes the pattern uses,
+   halved until they fit in 31 rows. A note is drawn from its step for its
+   duration, wrapping round to the start when it sounds past the end. The
+   bottom row marks the beats, and the playing step is shown inverted.
+
+   pianoroll_draw renders the whole pattern, but only columns whose pixels
+   changed are sent, and moving the playhead sends just the columns it
+   leaves and enters. */
+
+#include <stdint.h>
+#include "framebuffer.h"
+#include "midi.h"
+#include "pianoroll.h"
+
+#define NOTE_ROWS (FB_HEIGHT - 1)					// The bottom row is for the beats
+#define BEAT_ROW (FB_HEIGHT - 1)
+
+static int note_low = 0;
+static int note_shift = 0;
+
+static int note_row(int note) {
+	return NOTE_ROWS - 1 - ((note - note_low) >> note_shift);
+}
+
+static int is_note_on(struct message m) {
+	return (m.command & 0xF0) == 0x90 && m.velocity;
+}
+
+// Fits the notes of the pattern into the rows, centred when they take fewer
+static void fit_notes(struct pattern *p) {
+	int high = -1;
+	int low = 128;
+	int i;
+	unsigned short e;
+
+	for (i = 0; i < p->length; i++) {
+		for (e = p->first[i]; e != NO_EVENT; e = events[e].next) {
+			if (is_note_on(events[e].msg)) {
+				if (events[e].msg.note > high) {
+					high = events[e].msg.note;
+				}
+				if (events[e].msg.note < low) {
+					low = events[e].msg.note;
+				}
+			}
+		}
+	}
+	if (high < 0) {
+		high = low = 60;
+	}
+	note_shift = 0;
+	while (((high - low) >> note_shift) >= NOTE_ROWS) {
+		note_shift++;
+	}
+	note_low = low - (NOTE_ROWS - 1 - ((high - low) >> note_shift)) / 2;
+}
+
+void pianoroll_draw(struct pattern *p) {
+	uint32_t pixels[FB_WIDTH];
+	int length = p->length;
+	int ticks = length * CLOCKS_PER_STEP;
+	int step, row, x, x1;
+	unsigned short e;
+
+	fit_notes(p);
+	for (x = 0; x < FB_WIDTH; x++) {
+		pixels[x] = 0;
+	}
+
+	for (step = 0; step < length; step++) {
+		int start = step * CLOCKS_PER_STEP;
+		if ((step & 3) == 0) {
+			pixels[step * FB_WIDTH / length] |= 1u << BEAT_ROW;
+		}
+		for (e = p->first[step]; e != NO_EVENT; e = events[e].next) {
+			struct message m = events[e].msg;
+			row = note_row(m.note);
+			if (!is_note_on(m) || row < 0 || row >= NOTE_ROWS) {
+				continue;
+			}
+			int duration = m.duration ? m.duration : CLOCKS_PER_STEP;	// Still held
+			if (duration > ticks) {
+				duration = ticks;
+			}
+			x = start * FB_WIDTH / ticks;
+			x1 = ((start + duration) * FB_WIDTH + ticks - 1) / ticks - 1;	// Last pixel it reaches
+			do {
+				pixels[x % FB_WIDTH] |= 1u << row;
+			} while (++x <= x1);
+		}
+	}
+
+	for (x = 0; x < FB_WIDTH; x++) {
+		fb_column(x, pixels[x]);
+	}
+}
+
+void pianoroll_playhead(int step, int length) {
+	int x0 = step * FB_WIDTH / length;
+	int x1 = (step + 1) * FB_WIDTH / length - 1;
+	fb_highlight(x0, x1 < x0 ? x0 : x1);
+}
@@ -0,0 +1,12 @@
+/* pianoroll.h
+   Piano roll view of a pattern on the framebuffer. */
+
+#ifndef PIANOROLL_H
+#define PIANOROLL_H
+
+#include "sequencer.h"
+
+void pianoroll_draw(struct pattern *p);
+void pianoroll_playhead(int step, int length);
+
+#endif
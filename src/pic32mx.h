@@ -1049,6 +1049,14 @@
 #define PIC32_NVMCON_WR         0x00008000
 
 
+/*
+ * Timer1 registers
+ */
+#define T1CON 		PIC32_R (0x0600)
+#define T1CONSET 	PIC32_R (0x0608)
+#define TMR1  		PIC32_R (0x0610)
+#define PR1   		PIC32_R (0x0620)
+
 /*
  * Timer2 registers
  */
@@ -1057,6 +1065,15 @@
 #define TMR2  		PIC32_R (0x0810)
 #define PR2   		PIC32_R (0x0820)
 
+/*
+ * Timer3 registers
+ */
+#define T3CON 		PIC32_R (0x0A00)
+#define T3CONCLR 	PIC32_R (0x0A04)
+#define T3CONSET 	PIC32_R (0x0A08)
+#define TMR3  		PIC32_R (0x0A10)
+#define PR3   		PIC32_R (0x0A20)
+
 /*
  * Output compare registers
  */
@@ -0,0 +1,22 @@
+/* rng.c
+   Pseudo-random numbers for the arpeggiator and note probabilities.
+
+   Marsaglia's xorshift32: three shifts and xors a number, never 0, with a
+   period of 2^32 - 1. The same seed gives the same sequence, which makes
+   a replay with a fixed seed play the same notes. */
+
+#include "rng.h"
+
+static unsigned int state = RNG_DEFAULT_SEED;
+
+// Any seed but 0, which would stay 0
+void rng_seed(unsigned int seed) {
+	state = seed ? seed : RNG_DEFAULT_SEED;
+}
+
+unsigned int rng_next() {
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
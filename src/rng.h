@@ -0,0 +1,12 @@
+/* rng.h
+   Pseudo-random numbers for the arpeggiator and note probabilities. */
+
+#ifndef RNG_H
+#define RNG_H
+
+#define RNG_DEFAULT_SEED 0x2545F491
+
+void rng_seed(unsigned int seed);
+unsigned int rng_next(void);
+
+#endif
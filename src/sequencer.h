@@ -0,0 +1,67 @@
+/* sequencer.h
+   Pattern geometry and the message store shared between main.c and the
+   modules that read or write recorded patterns.
+
+   All patterns share one pool of events. Each column of a pattern is a
+   list of events linked through the pool, so a pattern only uses as many
+   events as it has recorded and switching pattern is a pointer swap.
+
+   The notes of each channel form a track. A track follows the pattern
+   length unless it has its own, so tracks of different lengths drift
+   against each other (track.c).
+
+   The store holds note ons only, each with its duration in clock ticks.
+   Playback schedules the note off from the duration (noteoff.c), so a
+   note can not lose its note off to an edit. */
+
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include "config.h"
+
+#define NO_EVENT 0xFFFF
+#define MAX_DURATION 0xFFF			// Clock ticks, the most storage keeps
+#define TRACKS 16								// One per MIDI channel
+#define TRACK_LENGTH_MAX 255
+
+/* struct for MIDI messages */
+struct message {
+	unsigned char command;
+	unsigned char note;
+	unsigned char velocity;
+	unsigned char enable : 1;
+	unsigned char condition : 7;	// Loops a stored note plays on, see trig.h
+	unsigned short duration : 12;	// Clock ticks a stored note sounds, 0 while still held
+	unsigned short skip : 4;			// Sixteenths of the time a stored note is left out, 15 always
+};
+
+/* A message in the event pool, linked to the next message of its column */
+struct event {
+	struct message msg;
+	unsigned short next;
+};
+
+struct pattern {
+	unsigned short length;										// Columns played before wrapping, 1 to COLUMNS
+	unsigned short first[COLUMNS];						// First event of each column
+	unsigned short last[COLUMNS];							// Last event of each column, for appending
+	unsigned char column_lengths[COLUMNS];		// Number of messages stored in each column
+	unsigned char track_lengths[TRACKS];			// Own length of each channel, 0 to follow length
+};
+
+extern struct event events[POOL_SIZE];
+extern struct pattern patterns[PATTERNS];
+extern struct pattern *current_pattern;		// Pattern being played
+extern int queued_pattern;								// Pattern to switch to at the end of the loop
+
+void pattern_init(void);
+int pattern_index(struct pattern *p);
+void pattern_index_notes(void);
+int pattern_may_hold(int column, unsigned char note);
+int pattern_append(struct pattern *p, int column, struct message msg);
+void pattern_remove(struct pattern *p, int column, unsigned short prev, unsigned short e);
+void pattern_truncate(struct pattern *p, int column, int length);
+void pattern_set_length(struct pattern *p, int length);
+void pattern_set_track_length(struct pattern *p, int channel, int length);
+
+#endif
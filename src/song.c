@@ -0,0 +1,59 @@
+/* song.c
+   Song mode. The step engine asks for the next pattern while the last
+   column of the playing one is still sounding, so the pattern after a chain
+   boundary is ready before the boundary step and the switch itself is just
+   the same pointer swap as a queued pattern change. */
+
+#include "sequencer.h"
+#include "song.h"
+#include "storage.h"
+
+struct song_entry song[SONG_LENGTH];
+int song_length = 0;
+int song_active = 0;
+
+static int song_position = 0;		// Entry being played
+static int song_loop = 0;				// Loops of that entry played so far
+
+void song_clear() {
+	song_length = 0;
+	song_active = 0;
+	storage_mark_song_dirty();
+}
+
+// Adds a loop of pattern to the end of the song
+void song_append(int pattern) {
+	if (song_length > 0 && song[song_length - 1].pattern == pattern &&
+			song[song_length - 1].repeats < 0xFF) {
+		song[song_length - 1].repeats++;
+	} else if (song_length < SONG_LENGTH) {
+		song[song_length].pattern = pattern;
+		song[song_length].repeats = 1;
+		song_length++;
+	}
+	storage_mark_song_dirty();
+}
+
+// Plays the song from its first entry at the next loop point
+void song_start() {
+	if (song_length > 0) {
+		song_position = 0;
+		song_loop = 0;
+		song_active = 1;
+		queued_pattern = song[0].pattern;
+	}
+}
+
+/*
+	Counts one finished loop of the playing entry and returns the pattern
+	to play after it. Called at the last column of every loop in song mode.
+*/
+struct pattern *song_next() {
+	if (++song_loop >= song[song_position].repeats) {
+		song_loop = 0;
+		if (++song_position == song_length) {
+			song_position = 0;
+		}
+	}
+	return &patterns[song[song_position].pattern];
+}
@@ -0,0 +1,23 @@
+/* song.h
+   Song mode, a list of patterns played in order with repeat counts. */
+
+#ifndef SONG_H
+#define SONG_H
+
+#include "config.h"
+
+struct song_entry {
+	unsigned char pattern;
+	unsigned char repeats;		// Number of loops of pattern, at least 1
+};
+
+extern struct song_entry song[SONG_LENGTH];
+extern int song_length;
+extern int song_active;				// 1 while the song chooses the next pattern
+
+void song_clear(void);
+void song_append(int pattern);
+void song_start(void);
+struct pattern *song_next(void);
+
+#endif
@@ -0,0 +1,105 @@
+/* stepedit.c
+   Entering notes one step at a time while paused.
+
+   Paused with the record switch up, each note on from the input is
+   written into the step under the playhead at once, a step long, so
+   chords are just notes arriving together. The playhead is moved with a
+   button; moving on while keys are still down ties their notes into the
+   next step, and moving on with no keys down leaves a rest.
+
+   The keys still down are kept with the event of their note, so a tie
+   lengthens those events directly and nothing else of the pattern is
+   looked at. A note on only looks through its own column, for the same
+   note entered twice. The receive interrupt enters the notes and the
+   main loop ties them, so tying runs with interrupts disabled. */
+
+#include "init.h"
+#include "midi.h"
+#include "stepedit.h"
+#include "storage.h"
+#include "track.h"
+#include "trig.h"
+
+struct held_key {
+	struct pattern *pattern;
+	unsigned short column;
+	unsigned short event;
+	unsigned char channel;
+	unsigned char note;
+};
+
+static struct held_key held[STEPEDIT_HELD];
+static int held_count = 0;
+
+static void forget(int i) {
+	held[i] = held[--held_count];
+}
+
+/*
+	Enters a note on, or ends a key for velocity 0, on the step of the
+	pattern at column. Notes of tracks with their own length go on the
+	column their track is on. Returns 1 if the pattern changed.
+*/
+int stepedit_note(struct pattern *p, int column, unsigned char channel, unsigned char note,
+		unsigned char velocity) {
+	int i;
+	for (i = 0; i < held_count; i++) {
+		if (held[i].channel == channel && held[i].note == note) {
+			forget(i);
+			break;
+		}
+	}
+	if (!velocity) {
+		return 0;
+	}
+
+	column = track_column(channel, column) % track_length(p, channel);	// The length may just have shrunk
+	unsigned short e;
+	for (e = p->first[column]; e != NO_EVENT; e = events[e].next) {
+		if (events[e].msg.note == note && (events[e].msg.command & 0xF) == channel) {
+			break;															// Entered again, only the velocity changes
+		}
+	}
+	if (e == NO_EVENT) {
+		struct message msg = {0x90 | channel, note, velocity, 1, trig_record_condition,
+			CLOCKS_PER_STEP, trig_record_skip};
+		if (!pattern_append(p, column, msg)) {		// Fails if the column or the pool is full
+			return 0;
+		}
+		e = p->last[column];
+	}
+	events[e].msg.velocity = velocity;
+	storage_mark_dirty(pattern_index(p), column);
+
+	if (held_count == STEPEDIT_HELD) {
+		forget(0);
+	}
+	struct held_key *k = &held[held_count++];
+	k->pattern = p;
+	k->column = column;
+	k->event = e;
+	k->channel = channel;
+	k->note = note;
+	return 1;
+}
+
+// Lengthens the notes of the keys still down by a step, as the playhead moves on
+void stepedit_tie() {
+	int i;
+	unsigned int status = disable_interrupt();
+	for (i = 0; i < held_count; i++) {
+		struct message *m = &events[held[i].event].msg;
+		if (m->duration <= MAX_DURATION - CLOCKS_PER_STEP) {
+			m->duration += CLOCKS_PER_STEP;
+			storage_mark_dirty(pattern_index(held[i].pattern), held[i].column);
+		}
+	}
+	restore_interrupt(status);
+}
+
+// Forgets the keys down, before their events can be removed or the mode ends
+void stepedit_release() {
+	unsigned int status = disable_interrupt();
+	held_count = 0;
+	restore_interrupt(status);
+}
@@ -0,0 +1,16 @@
+/* stepedit.h
+   Entering notes one step at a time while paused. */
+
+#ifndef STEPEDIT_H
+#define STEPEDIT_H
+
+#include "sequencer.h"
+
+#define STEPEDIT_HELD 16							// Keys tied over, the oldest is dropped past this
+
+int stepedit_note(struct pattern *p, int column, unsigned char channel, unsigned char note,
+	unsigned char velocity);
+void stepedit_tie(void);
+void stepedit_release(void);
+
+#endif
@@ -0,0 +1,407 @@
+/* storage.c
+   Persistent pattern storage as an append-only log in program flash.
+
+   Each save appends one record per changed column instead of rewriting the
+   whole bank. Records are packed into a RAM row buffer and written with
+   row programming, so a save costs a few row writes. The log runs round the
+   reserved pages as a ring, which spreads page erases evenly over them.
+
+   Layout of a page:
+     word 0        page header, PAGE_MAGIC << 16 | sequence number
+     word 1...     records, never crossing a row boundary
+   Layout of a record:
+     word 0        RECORD_MAGIC << 24 | message count << 16 | slot
+                   where slot is pattern * COLUMNS + column
+     word 1        CRC-16 of word 0 and the messages
+     word 2...     one word per note, duration << 20 | channel << 16 |
+                   trig << 15 | note << 8 | enable << 7 | velocity
+     then          condition << 4 | skip of each note with the trig bit,
+                   two to a word, low half first
+   The CRC covers the trig words too, so a note never comes back without
+   its probability and condition.
+   The song is stored in SONG_SLOT with one song_entry per word, and the
+   pattern lengths in LENGTH_SLOT with one word per pattern. The track
+   lengths of a pattern are in its TRACK_SLOT, four to a word with
+   channel 0 in the low byte.
+   An erased word (0xFFFFFFFF) where a record would start ends the row.
+
+   A record with a bad magic or CRC is a torn write; the scan skips the rest
+   of that row. When the head enters a page, the live records of the page
+   two ahead are rewritten from RAM, so every page is dead by the time it
+   gets erased and an interrupted save never loses the last good copy. */
+
+#include "flash.h"
+#include "midi.h"
+#include "sequencer.h"
+#include "song.h"
+#include "storage.h"
+
+#define PAGE_MAGIC 0x5EC2
+#define RECORD_MAGIC 0x5F
+#define RECORD_HEADER_WORDS 2
+#define ERASED 0xFFFFFFFF
+#define NO_PAGE 0xFF
+#define SONG_SLOT (PATTERNS * COLUMNS)
+#define LENGTH_SLOT (SONG_SLOT + 1)
+#define TRACK_SLOT(pattern) (LENGTH_SLOT + 1 + (pattern))
+#define TRIG_NONE 0xFFFF								// Unused half of the last trig word
+#define SLOTS TRACK_SLOT(PATTERNS)
+
+/* A row is only flushed when the next record does not fit, so the words
+   it leaves blank are fewer than the record that opens the next row, and
+   the whole bank takes at most twice its words. It must fit with three
+   pages spare. */
+#define RECORD_MAX_WORDS (RECORD_HEADER_WORDS + ROWS + ROWS / 2)
+#define BANK_WORDS (SLOTS * RECORD_HEADER_WORDS + POOL_SIZE + POOL_SIZE / 2 + \
+	SONG_LENGTH + PATTERNS + PATTERNS * TRACKS / 4)
+typedef char storage_capacity_check[
+	(2 * BANK_WORDS <= (FLASH_STORAGE_PAGES - 3) * FLASH_ROWS_PER_PAGE * (FLASH_ROW_WORDS - 1) &&
+	 RECORD_MAX_WORDS < FLASH_ROW_WORDS - 1 &&
+	 SONG_LENGTH <= ROWS && PATTERNS <= ROWS && SLOTS <= 0x10000 &&
+	 COLUMNS <= 0x100 && ROWS <= 0x100) ? 1 : -1];
+
+static unsigned int row_buffer[FLASH_ROW_WORDS];
+static int row_fill = 0;								// Words used in row_buffer
+static int head_page = FLASH_STORAGE_PAGES - 1;
+static int head_row = FLASH_ROWS_PER_PAGE;	// Next row to program in head_page
+static unsigned short head_sequence = 0;
+static unsigned char slot_page[SLOTS];			// Page holding the latest record of each slot
+static unsigned int dirty[(SLOTS + 31) / 32];
+
+static const unsigned short crc_nibble[16] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+/* CRC-16-CCITT over whole words, a nibble at a time */
+static unsigned short crc16(unsigned short crc, const unsigned int *data, int words) {
+	int i, shift;
+	for (i = 0; i < words; i++) {
+		for (shift = 28; shift >= 0; shift -= 4) {
+			crc = (crc << 4) ^ crc_nibble[(crc >> 12) ^ ((data[i] >> shift) & 0xF)];
+		}
+	}
+	return crc;
+}
+
+static int has_trig(struct message msg) {
+	return msg.skip || msg.condition;
+}
+
+static unsigned int pack_message(struct message msg) {
+	return (msg.duration << 20) | ((msg.command & 0xF) << 16) | (has_trig(msg) << 15) |
+		((msg.note & 0x7F) << 8) | ((msg.enable & 1) << 7) | (msg.velocity & 0x7F);
+}
+
+static struct message unpack_message(unsigned int word) {
+	struct message msg = {0x90 | ((word >> 16) & 0xF), (word >> 8) & 0x7F, word & 0x7F, (word >> 7) & 1,
+		0, word >> 20};
+	if (msg.duration == 0) {
+		msg.duration = CLOCKS_PER_STEP;			// Saved while still held
+	}
+	return msg;
+}
+
+static void mark_slot(int slot) {
+	dirty[slot >> 5] |= 1 << (slot & 31);
+}
+
+/* Packs the probabilities and conditions of the notes of a column into
+   words, or only counts them when words is 0. Returns the number of
+   words. */
+static int pack_trigs(struct pattern *p, int column, unsigned int *words) {
+	int n = 0;
+	unsigned short e;
+	for (e = p->first[column]; e != NO_EVENT; e = events[e].next) {
+		struct message m = events[e].msg;
+		if (has_trig(m)) {
+			if (words) {
+				unsigned int half = (m.condition << 4) | m.skip;
+				words[n / 2] = (n & 1) ? ((words[n / 2] & 0xFFFF) | (half << 16)) : ((TRIG_NONE << 16) | half);
+			}
+			n++;
+		}
+	}
+	return (n + 1) / 2;
+}
+
+// Number of trig words after count note words
+static int trig_words(const unsigned int *notes, int count) {
+	int i, n = 0;
+	for (i = 0; i < count; i++) {
+		n += (notes[i] >> 15) & 1;
+	}
+	return (n + 1) / 2;
+}
+
+void storage_mark_dirty(int pattern, int column) {
+	mark_slot(pattern * COLUMNS + column);
+}
+
+void storage_mark_song_dirty() {
+	mark_slot(SONG_SLOT);
+}
+
+void storage_mark_length_dirty() {
+	mark_slot(LENGTH_SLOT);
+}
+
+void storage_mark_tracks_dirty(int pattern) {
+	mark_slot(TRACK_SLOT(pattern));
+}
+
+void storage_mark_all_dirty(int pattern) {
+	int i;
+	for (i = 0; i < COLUMNS; i++) {
+		storage_mark_dirty(pattern, i);
+	}
+}
+
+/* Pads and programs the row buffer, then opens the next row */
+static void flush_row() {
+	int i;
+	for (i = row_fill; i < FLASH_ROW_WORDS; i++) {
+		row_buffer[i] = ERASED;
+	}
+	flash_program_row(head_page, head_row, row_buffer);
+	head_row++;
+	row_fill = 0;
+}
+
+// Queues every slot whose latest record lives in page for rewriting
+static void evacuate_page(int page) {
+	int i;
+	for (i = 0; i < SLOTS; i++) {
+		if (slot_page[i] == page) {
+			mark_slot(i);
+		}
+	}
+}
+
+/*
+	Moves the head to the next page. The page is erased here, its header goes
+	out with its first row. The page two ahead is evacuated now so it holds
+	no live data by the time the head reaches it.
+*/
+static void open_page() {
+	head_page = (head_page + 1) % FLASH_STORAGE_PAGES;
+	head_row = 0;
+	head_sequence++;
+	flash_erase_page(head_page);
+	row_buffer[0] = (PAGE_MAGIC << 16) | head_sequence;
+	row_fill = 1;
+	evacuate_page((head_page + 2) % FLASH_STORAGE_PAGES);
+}
+
+static void append_record(int slot) {
+	struct pattern *p = 0;									// Only for the slots of a pattern
+	int column = slot % COLUMNS;
+	int count = 0;
+	int trigs = 0;											// Words after the notes of a column
+	int words;
+	int i;
+	unsigned short e;
+
+	if (slot == SONG_SLOT) {
+		count = song_length;
+	} else if (slot == LENGTH_SLOT) {
+		count = PATTERNS;
+	} else if (slot >= TRACK_SLOT(0)) {
+		p = &patterns[slot - TRACK_SLOT(0)];
+		count = TRACKS / 4;
+	} else {
+		p = &patterns[slot / COLUMNS];
+		count = p->column_lengths[column];
+		trigs = pack_trigs(p, column, 0);
+	}
+	words = RECORD_HEADER_WORDS + count + trigs;
+
+	if (head_row == FLASH_ROWS_PER_PAGE) {
+		open_page();
+	} else if (row_fill + words > FLASH_ROW_WORDS) {
+		flush_row();
+		if (head_row == FLASH_ROWS_PER_PAGE) {
+			open_page();
+		}
+	}
+
+	unsigned int *record = &row_buffer[row_fill];
+	record[0] = (RECORD_MAGIC << 24) | (count << 16) | slot;
+	if (slot == SONG_SLOT) {
+		for (i = 0; i < count; i++) {
+			record[RECORD_HEADER_WORDS + i] = (song[i].pattern << 8) | song[i].repeats;
+		}
+	} else if (slot == LENGTH_SLOT) {
+		for (i = 0; i < count; i++) {
+			record[RECORD_HEADER_WORDS + i] = patterns[i].length;
+		}
+	} else if (slot >= TRACK_SLOT(0)) {
+		for (i = 0; i < count; i++) {
+			record[RECORD_HEADER_WORDS + i] = p->track_lengths[4 * i] | (p->track_lengths[4 * i + 1] << 8) |
+				(p->track_lengths[4 * i + 2] << 16) | (p->track_lengths[4 * i + 3] << 24);
+		}
+	} else {
+		for (i = 0, e = p->first[column]; i < count; i++, e = events[e].next) {
+			record[RECORD_HEADER_WORDS + i] = pack_message(events[e].msg);
+		}
+		pack_trigs(p, column, &record[RECORD_HEADER_WORDS + count]);
+	}
+	record[1] = crc16(0xFFFF, record, 1);
+	record[1] = crc16(record[1], &record[RECORD_HEADER_WORDS], count + trigs);
+	row_fill += words;
+	slot_page[slot] = head_page;
+}
+
+// Appends a record for every column changed since the last save
+void storage_save() {
+	int i;
+	int pending = 1;
+	while (pending) {									// Opening a page can queue more slots
+		pending = 0;
+		for (i = 0; i < SLOTS; i++) {
+			if (dirty[i >> 5] & (1 << (i & 31))) {
+				dirty[i >> 5] &= ~(1 << (i & 31));
+				append_record(i);
+				pending = 1;
+			}
+		}
+	}
+	if (row_fill > 0) {
+		flush_row();
+	}
+}
+
+// Applies the valid records of one page, returns the first unused row
+static int scan_page(int page) {
+	const unsigned int *words = flash_page(page);
+	int row, w, i;
+	int used_rows = 0;
+
+	for (row = 0; row < FLASH_ROWS_PER_PAGE; row++) {
+		const unsigned int *r = &words[row * FLASH_ROW_WORDS];
+		w = (row == 0) ? 1 : 0;
+		while (w + RECORD_HEADER_WORDS <= FLASH_ROW_WORDS && r[w] != ERASED) {
+			unsigned int header = r[w];
+			int count = (header >> 16) & 0xFF;
+			int slot = header & 0xFFFF;
+			if ((header >> 24) != RECORD_MAGIC || slot >= SLOTS || count > ROWS ||
+					(slot == SONG_SLOT && count > SONG_LENGTH) ||
+					(slot == LENGTH_SLOT && count > PATTERNS) ||
+					w + RECORD_HEADER_WORDS + count > FLASH_ROW_WORDS) {
+				break;
+			}
+			int trigs = (slot < SONG_SLOT) ? trig_words(&r[w + RECORD_HEADER_WORDS], count) : 0;
+			if (w + RECORD_HEADER_WORDS + count + trigs > FLASH_ROW_WORDS) {
+				break;
+			}
+			unsigned short crc = crc16(0xFFFF, &r[w], 1);
+			if (r[w + 1] != crc16(crc, &r[w + RECORD_HEADER_WORDS], count + trigs)) {
+				break;												// Torn write, drop the rest of the row
+			}
+			if (slot == SONG_SLOT) {
+				for (i = 0; i < count; i++) {
+					song[i].pattern = (r[w + RECORD_HEADER_WORDS + i] >> 8) % PATTERNS;
+					song[i].repeats = r[w + RECORD_HEADER_WORDS + i] & 0xFF;
+					if (song[i].repeats == 0) {
+						song[i].repeats = 1;
+					}
+				}
+				song_length = count;
+			} else if (slot == LENGTH_SLOT) {
+				for (i = 0; i < count; i++) {
+					pattern_set_length(&patterns[i], r[w + RECORD_HEADER_WORDS + i]);
+				}
+			} else if (slot >= TRACK_SLOT(0)) {
+				for (i = 0; i < TRACKS && i / 4 < count; i++) {
+					pattern_set_track_length(&patterns[slot - TRACK_SLOT(0)], i,
+						(r[w + RECORD_HEADER_WORDS + i / 4] >> (8 * (i & 3))) & 0xFF);
+				}
+			} else {
+				struct pattern *p = &patterns[slot / COLUMNS];
+				const unsigned int *trig = &r[w + RECORD_HEADER_WORDS + count];
+				int n = 0;
+				pattern_truncate(p, slot % COLUMNS, 0);
+				for (i = 0; i < count; i++) {
+					unsigned int word = r[w + RECORD_HEADER_WORDS + i];
+					struct message m = unpack_message(word);
+					if (word & (1 << 15)) {
+						unsigned int half = trig[n / 2] >> (16 * (n & 1));
+						m.condition = (half >> 4) & 0x7F;
+						m.skip = half & 0xF;
+						n++;
+					}
+					pattern_append(p, slot % COLUMNS, m);
+				}
+			}
+			slot_page[slot] = page;
+			w += RECORD_HEADER_WORDS + count + trigs;
+		}
+		for (i = 0; i < FLASH_ROW_WORDS; i++) {	// Any programmed word makes the row used
+			if (r[i] != ERASED) {
+				used_rows = row + 1;
+				break;
+			}
+		}
+	}
+	return used_rows;
+}
+
+/*
+	Rebuilds the pattern bank from the log, which must start out empty.
+	Pages are replayed from the oldest sequence number to the newest so
+	later records win. Returns the number of columns that were restored.
+*/
+int storage_load() {
+	int order[FLASH_STORAGE_PAGES];
+	int pages = 0;
+	int i, j;
+
+	for (i = 0; i < SLOTS; i++) {
+		slot_page[i] = NO_PAGE;
+	}
+	for (i = 0; i < (SLOTS + 31) / 32; i++) {
+		dirty[i] = 0;
+	}
+
+	/* Insertion sort valid pages by sequence, wrap safe */
+	for (i = 0; i < FLASH_STORAGE_PAGES; i++) {
+		unsigned int header = flash_page(i)[0];
+		if ((header >> 16) != PAGE_MAGIC) {
+			continue;
+		}
+		for (j = pages; j > 0; j--) {
+			short diff = (short) ((header & 0xFFFF) - (flash_page(order[j - 1])[0] & 0xFFFF));
+			if (diff >= 0) {
+				break;
+			}
+			order[j] = order[j - 1];
+		}
+		order[j] = i;
+		pages++;
+	}
+
+	for (i = 0; i < pages; i++) {
+		head_row = scan_page(order[i]);
+	}
+
+	if (pages > 0) {
+		head_page = order[pages - 1];
+		head_sequence = flash_page(head_page)[0] & 0xFFFF;
+	} else {
+		head_page = FLASH_STORAGE_PAGES - 1;
+		head_row = FLASH_ROWS_PER_PAGE;
+	}
+	row_fill = 0;
+
+	/* Finish an evacuation that a power loss may have cut short */
+	evacuate_page((head_page + 1) % FLASH_STORAGE_PAGES);
+	evacuate_page((head_page + 2) % FLASH_STORAGE_PAGES);
+
+	int restored = 0;
+	for (i = 0; i < SLOTS; i++) {
+		if (slot_page[i] != NO_PAGE) {
+			restored++;
+		}
+	}
+	return restored;
+}
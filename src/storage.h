@@ -0,0 +1,10 @@
+/* storage.h
+   Persistent pattern storage, see storage.c for the flash log format. */
+
+int storage_load(void);
+void storage_save(void);
+void storage_mark_dirty(int pattern, int column);
+void storage_mark_all_dirty(int pattern);
+void storage_mark_song_dirty(void);
+void storage_mark_length_dirty(void);
+void storage_mark_tracks_dirty(int pattern);
@@ -4,9 +4,11 @@
 
  * For copyright and licensing, see file COPYING */
 
-/* Non-Maskable Interrupt; something bad likely happened, so hang */
+#include "diag.h"
+
+/* Non-Maskable Interrupt; something bad likely happened, record it and reset */
 void _nmi_handler() {
-	for(;;);
+	crash_capture(CRASH_NMI);
 }
 
 /* This function is called upon reset, before .data and .bss is set up */
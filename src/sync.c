@@ -0,0 +1,162 @@
+/* sync.c
+   Clock slave mode.
+
+   Incoming clock bytes are timestamped with the core timer in the receive
+   interrupt. The period between them is low-pass filtered, and once a beat
+   of steady clock has arrived Timer2 is steered to it: its period is set
+   from the filtered estimate plus a proportional phase correction. Steps
+   keep coming from Timer2, so jitter on the incoming clock is smoothed out
+   instead of being passed on to the notes. Clocks and Timer2 ticks are
+   counted from the start of playback, so when the lock comes after the
+   start the steps still end up where the master's clocks put them. */
+
+#include <pic32mx.h>
+#include "init.h"
+#include "midi.h"
+#include "sync.h"
+
+#define LOCK_CLOCKS 24												// Steady clocks needed before following
+#define FILTER_SHIFT 3												// Period filter weight 1/8
+#define PHASE_SHIFT 2													// Phase error corrected 1/4 per clock
+#define TIMEOUT_CLOCKS 4											// Missing clocks that end the lock
+#define MIN_CLOCK_PERIOD (CORE_TIMER_HZ / 24 * 60 / 400)	// 400 BPM
+#define MAX_CLOCK_PERIOD (CORE_TIMER_HZ / 24 * 60 / 20)		// 20 BPM
+#define COUNTS_PER_TIMER2 (CORE_TIMER_HZ / TIMER2_HZ)
+
+extern int play;
+extern int next_period;
+
+int clock_locked = 0;
+volatile int remote_command = 0;
+volatile int remote_position = -1;
+
+static unsigned int last_clock;				// Core timer at the last clock byte
+static unsigned int period_q4;				// Filtered clock period, core timer counts * 16
+static int steady_clocks = 0;
+static int outliers = 0;							// Clocks in a row far from the estimate
+static int clock_balance = 0;					// Clocks received minus Timer2 ticks while playing
+static int counting = 0;							// 1 while clock_balance is kept
+static unsigned int last_counted;			// Core timer at the start or the last clock counted
+
+// Sets Timer2 to the estimated period, corrected by how far its tick is from the clock
+static void steer() {
+	int period = (period_q4 >> 4) / COUNTS_PER_TIMER2;
+	int lead = TMR2 - clock_balance * (int) (PR2 + 1);	// > 0 when Timer2 ticked early
+	int corrected = period - 1 + (lead >> PHASE_SHIFT);
+	if (corrected < period / 2) {
+		corrected = period / 2;
+	} else if (corrected > period * 2) {
+		corrected = period * 2;
+	}
+	next_period = corrected;
+}
+
+static void clock_received() {
+	unsigned int now = read_core_timer();
+	unsigned int measured = now - last_clock;
+	unsigned int estimate = period_q4 >> 4;
+	last_clock = now;
+	if (counting && play) {								// Every clock, the steady ones only set the period
+		clock_balance++;
+		last_counted = now;
+	}
+
+	if (measured < MIN_CLOCK_PERIOD || measured > MAX_CLOCK_PERIOD) {
+		steady_clocks = 0;								// First clock after a pause
+		return;
+	}
+	if (steady_clocks == 0) {
+		period_q4 = measured << 4;
+	} else if (measured > estimate + estimate / 2 || measured < estimate / 2) {
+		if (steady_clocks < LOCK_CLOCKS || ++outliers == TIMEOUT_CLOCKS) {
+			period_q4 = measured << 4;				// Not a lost or doubled byte, a new tempo
+			outliers = 0;
+			if (steady_clocks < LOCK_CLOCKS) {
+				steady_clocks = 1;
+			}
+		}
+		return;														// A lost or doubled byte keeps the estimate
+	} else {
+		outliers = 0;
+		period_q4 += (int) ((measured << 4) - period_q4) >> FILTER_SHIFT;
+	}
+
+	if (steady_clocks < LOCK_CLOCKS) {
+		if (++steady_clocks == LOCK_CLOCKS) {
+			clock_locked = 1;
+			if (!counting) {									// No start to count from, steps keep their phase
+				clock_balance = 0;
+				counting = 1;
+			}
+		}
+		return;
+	}
+	if (play) {
+		steer();
+	}
+}
+
+// Real-time bytes from the receive interrupt
+void sync_realtime(unsigned char byte) {
+	switch (byte) {
+		case MIDI_CLOCK:
+			clock_received();
+			break;
+		case MIDI_START:
+		case MIDI_CONTINUE:
+		case MIDI_STOP:
+			remote_command = byte;
+			break;
+	}
+}
+
+void sync_song_position(int steps) {
+	remote_position = steps;
+}
+
+// Called from every Timer2 tick
+void sync_tick() {
+	if (counting) {
+		clock_balance--;
+	}
+}
+
+/*
+	Playback starts, Timer2 restarts in phase with the next clock. The
+	balance is kept from here, so a lock reached while playing moves the
+	steps to where the clocks since the start put them.
+*/
+void sync_start() {
+	clock_balance = 0;
+	counting = 1;
+	last_counted = read_core_timer();
+	TMR2 = 0;
+	if (clock_locked) {
+		PR2 = (period_q4 >> 4) / COUNTS_PER_TIMER2 - 1;
+	}
+}
+
+/*
+	Drops the lock when the master stops sending clock, and stops counting
+	when no clock comes at all, so playing without a master doesn't run up
+	a balance a later lock would chase. Called from the main loop.
+*/
+void sync_poll() {
+	if (clock_locked && read_core_timer() - last_clock > TIMEOUT_CLOCKS * (period_q4 >> 4)) {
+		clock_locked = 0;
+		steady_clocks = 0;
+		counting = 0;
+	} else if (!clock_locked && counting && read_core_timer() - last_counted > TIMEOUT_CLOCKS * MAX_CLOCK_PERIOD) {
+		counting = 0;
+	}
+}
+
+// Tempo of the external clock in BPM
+int sync_tempo() {
+	return (sync_tempo_tenths() + 5) / 10;
+}
+
+// Tempo of the external clock in tenths of a BPM
+int sync_tempo_tenths() {
+	return (CORE_TIMER_HZ / 24 * 60 * 10) / (period_q4 >> 4);
+}
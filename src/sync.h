@@ -0,0 +1,19 @@
+/* sync.h
+   Following an external MIDI clock. */
+
+#ifndef SYNC_H
+#define SYNC_H
+
+extern int clock_locked;						// 1 while Timer2 follows an external clock
+extern volatile int remote_command;	// Start, continue or stop from the master, 0 if none
+extern volatile int remote_position;	// Song position from the master, -1 if none
+
+void sync_realtime(unsigned char byte);
+void sync_song_position(int steps);
+void sync_tick(void);
+void sync_start(void);
+void sync_poll(void);
+int sync_tempo(void);
+int sync_tempo_tenths(void);
+
+#endif
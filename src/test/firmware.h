@@ -0,0 +1,40 @@
+/* firmware.h
+   What the host tests reach of main.c and init.c, which keep these out of
+   their headers. */
+
+#ifndef FIRMWARE_H
+#define FIRMWARE_H
+
+#include "sequencer.h"
+
+/* main.c */
+extern int current_column;
+extern int time_counter;
+extern volatile unsigned int clock_ticks;
+extern int tempo;
+extern int next_period;
+extern int steps_played;
+extern int play;
+extern int record;
+extern unsigned short channels_used;
+extern unsigned short channel_mask;
+
+void boot(void);
+void timer2_isr(void);
+void update_tempo(void);
+int step_room(void);
+void play_column(unsigned int step_tick);
+void play_step(void);
+void start_playback(int from_start);
+void stop_playback(void);
+void move_edit_step(int direction);
+void reset_undo(void);
+void save_column_lengths(void);
+void undo(void);
+void control_change(int channel, int controller, int value);
+void midi_message_received(unsigned char cmd, unsigned char data1, unsigned char data2);
+
+/* init.c */
+void timer_init(void);
+
+#endif
@@ -0,0 +1,123 @@
+/* flash.c
+   Host flash driver for the tests, backed by a file.
+
+   The storage region is the file mapped into memory, so the log survives
+   host_flash_close() and host_flash_open() like flash survives a power
+   cycle. Programming can only clear bits, as in NOR flash, and an erase
+   sets a whole page to ones.
+
+   host_flash_cut() makes the power fail once the given number of words
+   have been erased or programmed, usually part way through an operation.
+   The words up to the cut reach the flash, nothing after them does until
+   the next host_flash_open(). */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "flash.h"
+#include "test.h"
+
+#define REGION_SIZE (FLASH_STORAGE_PAGES * FLASH_PAGE_SIZE)
+#define NO_CUT -1
+
+static unsigned int *region;
+static int fd = -1;
+static int cut = NO_CUT;								// Words written before the power fails
+static int powered = 0;
+static int written = 0;
+static int erases[FLASH_STORAGE_PAGES];
+
+void host_flash_open(const char *path) {
+	struct stat st;
+	int i;
+	host_flash_close();
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0 || fstat(fd, &st) != 0 || ftruncate(fd, REGION_SIZE) != 0) {
+		perror(path);
+		exit(2);
+	}
+	region = mmap(0, REGION_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (region == MAP_FAILED) {
+		perror(path);
+		exit(2);
+	}
+	if (st.st_size == 0) {
+		for (i = 0; i < REGION_SIZE / 4; i++) {	// New file, flash comes erased
+			region[i] = 0xFFFFFFFF;
+		}
+		for (i = 0; i < FLASH_STORAGE_PAGES; i++) {
+			erases[i] = 0;
+		}
+	}
+	cut = NO_CUT;
+	powered = 1;
+}
+
+void host_flash_close() {
+	if (fd >= 0) {
+		munmap(region, REGION_SIZE);
+		close(fd);
+		fd = -1;
+	}
+}
+
+void host_flash_cut(int words) {
+	cut = words;
+}
+
+// Words erased or programmed since the start of the run
+int host_flash_written() {
+	return written;
+}
+
+// Erases of page since the file was created
+int host_flash_erases(int page) {
+	return erases[page];
+}
+
+// Overwrites a word, as a flipped bit or a stray write would
+void host_flash_poke(int page, int word, unsigned int value) {
+	region[page * FLASH_PAGE_WORDS + word] = value;
+}
+
+// Words the current operation gets before the power fails, if it does
+static int budget(int words) {
+	if (!powered) {
+		return 0;
+	}
+	if (cut != NO_CUT) {
+		if (cut < words) {
+			words = cut;
+			powered = 0;
+		}
+		cut -= words;
+	}
+	written += words;
+	return words;
+}
+
+const unsigned int *flash_page(int page) {
+	return &region[page * FLASH_PAGE_WORDS];
+}
+
+int flash_erase_page(int page) {
+	int i;
+	int n = budget(FLASH_PAGE_WORDS);
+	for (i = 0; i < n; i++) {
+		region[page * FLASH_PAGE_WORDS + i] = 0xFFFFFFFF;
+	}
+	erases[page]++;
+	return n < FLASH_PAGE_WORDS;
+}
+
+int flash_program_row(int page, int row, const unsigned int *data) {
+	int i;
+	int n = budget(FLASH_ROW_WORDS);
+	unsigned int *r = &region[page * FLASH_PAGE_WORDS + row * FLASH_ROW_WORDS];
+	for (i = 0; i < n; i++) {
+		r[i] &= data[i];
+	}
+	return n < FLASH_ROW_WORDS;
+}
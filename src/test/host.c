@@ -0,0 +1,125 @@
+/* host.c
+   What vectors.S provides on the target, for the host tests: the
+   interrupt switches, the wait for an interrupt, the core timer and the
+   persistent diagnostics. */
+
+#include <stdlib.h>
+#include <pic32mx.h>
+#include "diag.h"
+#include "init.h"
+#include "midi.h"
+#include "noteoff.h"
+#include "firmware.h"
+#include "test.h"
+
+volatile unsigned int host_sfr[HOST_SFR_WORDS];
+struct crash_report crash_report;
+struct diag_state diag_state;
+
+unsigned int host_spi[HOST_SPI_WORDS];
+int host_spi_count = 0;
+unsigned int host_core_timer = 0;
+int host_interrupts_on = 0;
+unsigned int host_wait_counts = 0;
+int host_waits = 0;
+int test_failures = 0;
+
+void enable_interrupt() {
+	host_interrupts_on = 1;
+}
+
+unsigned int disable_interrupt() {
+	unsigned int status = host_interrupts_on;
+	host_interrupts_on = 0;
+	return status;
+}
+
+void restore_interrupt(unsigned int status) {
+	host_interrupts_on = status;
+}
+
+// Moves on a count per read, so a wait bounded by the core timer ends
+unsigned int read_core_timer() {
+	return host_core_timer++;
+}
+
+void set_soft_interrupt(int on) {
+}
+
+// Timer1 moves on host_wait_counts while the CPU waits, wrapping at PR1
+void wait_for_interrupt() {
+	TMR1 = (TMR1 + host_wait_counts) % (PR1 + 1);
+	host_waits++;
+}
+
+void crash_capture(int kind) {
+	fprintf(stderr, "crash_capture(%d)\n", kind);
+	abort();
+}
+
+// The word of host_spi for the next access of SPI2BUF, wrapping when full
+volatile unsigned int *host_spi_next() {
+	unsigned int *word = &host_spi[host_spi_count++ % HOST_SPI_WORDS];
+	*word = HOST_NO_BYTE;
+	return word;
+}
+
+static volatile unsigned int rx_word;
+
+// The word U1RXREG reads, taking the byte received
+volatile unsigned int *host_rx_read() {
+	U1STA &= ~PIC32_USTA_URXDA;
+	return &rx_word;
+}
+
+// Receives byte as the receive interrupt and the parse interrupt after it
+void host_midi_in(unsigned char byte) {
+	rx_word = byte;
+	U1STA |= PIC32_USTA_URXDA;
+	midi_rx_isr();
+	midi_parse_isr();
+}
+
+/* Runs the transmit interrupt until it has nothing more to send and keeps
+   what it wrote to the UART. Returns the number of bytes. */
+int host_midi_out(unsigned char *bytes, int max) {
+	int n = 0;
+	while (n < max) {
+		U1TXREG = HOST_NO_BYTE;
+		midi_tx_isr();
+		if (U1TXREG == HOST_NO_BYTE) {
+			break;
+		}
+		bytes[n++] = U1TXREG;
+	}
+	return n;
+}
+
+/* Plays the next step as the main loop does when a step's clock ticks
+   have come, and keeps the notes of the note ons sent. Returns their
+   number. */
+int host_play_step(unsigned char *notes, int max) {
+	unsigned char bytes[256];
+	int i, n, count = 0;
+	clock_ticks += CLOCKS_PER_STEP;
+	time_counter = CLOCKS_PER_STEP;
+	noteoff_service(clock_ticks);
+	play_step();
+	while ((n = host_midi_out(bytes, sizeof(bytes))) > 0) {
+		for (i = 0; i + 2 < n; i += 3) {
+			if ((bytes[i] & 0xF0) == 0x90 && bytes[i + 2] && count < max) {
+				notes[count++] = bytes[i + 1];
+			}
+		}
+	}
+	return count;
+}
+
+int test_done(const char *name) {
+	if (test_failures) {
+		printf("%s: %d checks failed\n", name, test_failures);
+		return 1;
+	}
+	printf("%s: ok\n", name);
+	return 0;
+}
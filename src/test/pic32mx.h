@@ -0,0 +1,30 @@
+/* pic32mx.h
+   Host stand-in for the device header, found first on the include path of
+   the host tests. The register names come from the real header, but each
+   register is a word of host_sfr, so firmware reads back what it wrote
+   and a test can set a status bit before calling the code that polls it.
+   The SET, CLR and INV aliases are words of their own. SPI2BUF gives a
+   new word of host_spi on each access, so what the display driver sends
+   can be read back in order; reads find HOST_NO_BYTE there. U1RXREG gives
+   the byte host_midi_in() received and clears URXDA. */
+
+#ifndef HOST_PIC32MX_H
+#define HOST_PIC32MX_H
+
+#include "../pic32mx.h"
+
+#undef PIC32_R
+#define PIC32_R(a) host_sfr[(a) / 4]
+#define HOST_SFR_WORDS (0x90000 / 4)
+
+extern volatile unsigned int host_sfr[HOST_SFR_WORDS];
+
+#undef SPI2BUF
+#define SPI2BUF (*host_spi_next())
+volatile unsigned int *host_spi_next(void);
+
+#undef U1RXREG
+#define U1RXREG (*host_rx_read())
+volatile unsigned int *host_rx_read(void);
+
+#endif
@@ -0,0 +1,46 @@
+/* test.h
+   Checks and host controls shared by the host tests.
+
+   Each test_*.c is a program of its own, linked against the firmware
+   sources built for the host (see the test target in the Makefile). A
+   failed CHECK prints where it failed and the run carries on, so one run
+   lists every failure; test_done() turns the count into the exit status. */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+extern int test_failures;
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			test_failures++; \
+		} \
+	} while (0)
+
+int test_done(const char *name);
+
+/* host.c */
+extern unsigned int host_core_timer;				// Core timer, advances a count per read
+extern int host_interrupts_on;
+extern unsigned int host_wait_counts;			// Timer1 counts each wait_for_interrupt() lasts
+extern int host_waits;
+#define HOST_NO_BYTE 0x100								// In U1TXREG while nothing was sent
+int host_midi_out(unsigned char *bytes, int max);	// What the transmit interrupt sends
+void host_midi_in(unsigned char byte);				// A byte from the MIDI input
+int host_play_step(unsigned char *notes, int max);	// Note ons of the next step
+#define HOST_SPI_WORDS 4096
+extern unsigned int host_spi[HOST_SPI_WORDS];		// Accesses of SPI2BUF, see pic32mx.h
+extern int host_spi_count;
+
+/* flash.c, the flash driver backed by a file */
+void host_flash_open(const char *path);		// Powers up with the flash kept in path
+void host_flash_close(void);
+void host_flash_cut(int words);					// Power fails after words more are written
+int host_flash_written(void);
+int host_flash_erases(int page);
+void host_flash_poke(int page, int word, unsigned int value);
+
+#endif
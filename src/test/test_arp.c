@@ -0,0 +1,138 @@
+/* test_arp.c
+   Arpeggiator replays: the same held notes in every mode and over two
+   octaves, notes let go and the oldest dropped when too many are held,
+   random mode repeating itself from the same seed, and notes falling due
+   once per rate on the clock. */
+
+#include "arp.h"
+#include "midi.h"
+#include "rng.h"
+#include "firmware.h"
+#include "test.h"
+
+// Sets mode and checks the next n notes against expected
+static int replay(int mode, const unsigned char *expected, int n) {
+	struct message m;
+	int i, same = 1;
+	arp_set_mode(mode);
+	for (i = 0; i < n; i++) {
+		same &= arp_next(&m) && m.note == expected[i] && m.command == 0x92;
+	}
+	return same;
+}
+
+static void hold() {
+	arp_set_mode(ARP_OFF);										// Lets go of everything
+	arp_set_octaves(1);
+	arp_set_rate(CLOCKS_PER_STEP);
+	arp_note(2, 64, 100);
+	arp_note(2, 60, 90);
+	arp_note(2, 67, 80);
+}
+
+static void test_modes() {
+	static const unsigned char up[7] = {60, 64, 67, 60, 64, 67, 60};
+	static const unsigned char down[7] = {67, 64, 60, 67, 64, 60, 67};
+	static const unsigned char up_down[7] = {60, 64, 67, 64, 60, 64, 67};
+	static const unsigned char as_played[7] = {64, 60, 67, 64, 60, 67, 64};
+	static const unsigned char two_octaves[7] = {60, 64, 67, 72, 76, 79, 60};
+	static const unsigned char two_octaves_down[7] = {79, 76, 72, 67, 64, 60, 79};
+	struct message m;
+
+	hold();
+	CHECK(!arp_next(&m));										// Held, but off plays nothing
+	CHECK(replay(ARP_UP, up, 7));
+	CHECK(replay(ARP_DOWN, down, 7));
+	CHECK(replay(ARP_UP_DOWN, up_down, 7));
+	CHECK(replay(ARP_PLAYED, as_played, 7));
+	arp_set_octaves(2);
+	CHECK(replay(ARP_UP, two_octaves, 7));
+	CHECK(replay(ARP_DOWN, two_octaves_down, 7));
+	arp_set_octaves(1);
+
+	arp_set_mode(ARP_UP);
+	CHECK(arp_next(&m) && m.velocity == 90 && m.duration == CLOCKS_PER_STEP / 2);
+}
+
+static void test_release() {
+	static const unsigned char without_64[4] = {60, 67, 60, 67};
+	static const unsigned char newest[4] = {4, 5, 6, 7};
+	int i;
+
+	arp_set_mode(ARP_UP);
+	arp_note(2, 64, 100);
+	arp_note(2, 60, 90);
+	arp_note(2, 67, 80);
+	arp_note(2, 64, 0);
+	CHECK(replay(ARP_UP, without_64, 4));
+
+	arp_set_mode(ARP_OFF);
+	arp_set_mode(ARP_PLAYED);
+	for (i = 0; i < ARP_NOTES + 4; i++) {					// The first 4 are dropped
+		arp_note(2, i, 100);
+	}
+	CHECK(replay(ARP_PLAYED, newest, 4));
+}
+
+static void test_random() {
+	unsigned char first[32];
+	struct message m;
+	int i, seen = 0, same = 1;
+
+	hold();
+	arp_set_mode(ARP_RANDOM);
+	rng_seed(1234);
+	for (i = 0; i < 32; i++) {
+		arp_next(&m);
+		first[i] = m.note;
+		seen |= (m.note == 60) | (m.note == 64) << 1 | (m.note == 67) << 2;
+		CHECK(m.note == 60 || m.note == 64 || m.note == 67);
+	}
+	CHECK(seen == 7);
+	rng_seed(1234);
+	for (i = 0; i < 32; i++) {
+		same &= arp_next(&m) && m.note == first[i];
+	}
+	CHECK(same);
+}
+
+static void test_due() {
+	unsigned int ticks;
+	int due = 0;
+	arp_set_rate(3);
+	arp_due(0);
+	for (ticks = 1; ticks <= 24; ticks++) {
+		due += arp_due(ticks);
+		CHECK(!arp_due(ticks));								// Once per slot however often asked
+	}
+	CHECK(due == 8);
+}
+
+// Notes from the input go to the arpeggiator, not to the pattern
+static void test_input() {
+	struct message m;
+	pattern_init();
+	hold();
+	arp_set_mode(ARP_UP);
+	record = 1;
+	play = 1;
+	midi_message_received(0x92, 72, 100);
+	CHECK(current_pattern->column_lengths[current_column] == 0);
+	arp_next(&m);
+	arp_next(&m);
+	arp_next(&m);
+	CHECK(arp_next(&m) && m.note == 72);
+	midi_message_received(0x82, 72, 0);
+	CHECK(arp_next(&m) && m.note == 64);					// Fifth note, the second of three
+	record = 0;
+	play = 0;
+}
+
+int main() {
+	test_modes();
+	test_release();
+	test_random();
+	test_due();
+	test_input();
+	return test_done("arp");
+}
@@ -0,0 +1,75 @@
+/* test_bandwidth.c
+   The output budget of a step: step_room() gives the bytes the output
+   sends at 31250 baud in the time of a step at the Timer2 period, and
+   play_column() sends the loudest notes that fit in it and counts the
+   step as an overrun when some are left out. */
+
+#include <pic32mx.h>
+#include "init.h"
+#include "midi.h"
+#include "diag.h"
+#include "firmware.h"
+#include "test.h"
+
+static void test_room() {
+	unsigned char byte;
+
+	clock_out = 0;
+	PR2 = 3254;												// 120 BPM, a step is 3255 * 6 counts
+	CHECK(step_room() == 390);								// 125 ms at 3125 bytes a second
+
+	clock_out = 1;
+	CHECK(step_room() == 390 - CLOCKS_PER_STEP);
+	midi_send_byte(0xFE);
+	CHECK(step_room() == 390 - CLOCKS_PER_STEP - 1);
+	CHECK(host_midi_out(&byte, 1) == 1 && !midi_queued());
+
+	PR2 = 1323;												// 295 BPM, the fastest the pot gives
+	CHECK(step_room() == 158 - CLOCKS_PER_STEP);
+}
+
+/* A column of ROWS notes at 295 BPM: 64 note ons are 192 bytes and only
+   152 fit, so the 50 loudest go out */
+static void test_overrun() {
+	unsigned char bytes[512];
+	int i, n, ons = 0, softest = 127;
+	unsigned int overruns = diag_state.step_overruns;
+
+	pattern_init();
+	for (i = 0; i < ROWS; i++) {
+		struct message m = {0x90, i, 1 + (i * 37) % ROWS, 1, 0, CLOCKS_PER_STEP, 0};
+		pattern_append(current_pattern, 0, m);
+	}
+	channel_mask = 0xFFFF;
+	current_column = 0;
+	clock_out = 1;
+	PR2 = 1323;
+	while (midi_queued()) {
+		host_midi_out(bytes, sizeof(bytes));
+	}
+	play_column(0);
+	CHECK(diag_state.step_overruns == overruns + 1);
+	n = host_midi_out(bytes, sizeof(bytes));
+	for (i = 0; i < n; i += 3) {
+		if ((bytes[i] & 0xF0) == 0x90) {
+			ons++;
+			if (bytes[i + 2] < softest) {
+				softest = bytes[i + 2];
+			}
+		}
+	}
+	CHECK(ons == (158 - CLOCKS_PER_STEP) / 3);
+	CHECK(softest == 1 + ROWS - ons);					// Velocities 1 to ROWS, the loudest went
+
+	PR2 = 3254;													// At 120 BPM they all fit
+	overruns = diag_state.step_overruns;
+	play_column(0);
+	CHECK(diag_state.step_overruns == overruns);
+	host_midi_out(bytes, sizeof(bytes));
+}
+
+int main() {
+	test_room();
+	test_overrun();
+	return test_done("bandwidth");
+}
@@ -0,0 +1,85 @@
+/* test_banks.c
+   Patterns sharing the event pool: appending fails once the pool or a
+   column is full and truncated events are free again, and a program
+   change switches pattern only when the playing one wraps, with the
+   next pattern's events played without copying them. */
+
+#include <pic32mx.h>
+#include "midi.h"
+#include "firmware.h"
+#include "test.h"
+
+static void note(int pattern, int column, int n) {
+	struct message m = {0x90, n, 100, 1, 0, CLOCKS_PER_STEP, 0};
+	CHECK(pattern_append(&patterns[pattern], column, m));
+}
+
+static void test_pool() {
+	struct message m = {0x90, 60, 100, 1, 0, CLOCKS_PER_STEP, 0};
+	int i, appended = 0;
+
+	pattern_init();
+	for (i = 0; i < ROWS; i++) {
+		appended += pattern_append(&patterns[1], 5, m);
+	}
+	CHECK(appended == ROWS);
+	CHECK(!pattern_append(&patterns[1], 5, m));				// The column is full
+	CHECK(pattern_append(&patterns[1], 6, m));
+	appended++;
+
+	for (i = 0; appended < POOL_SIZE; i++) {					// Spread over the other patterns
+		appended += pattern_append(&patterns[2 + i % (PATTERNS - 2)], i / (PATTERNS - 2) % COLUMNS, m);
+	}
+	CHECK(!pattern_append(&patterns[0], 0, m));				// The pool is used up
+	CHECK(!pattern_append(&patterns[1], 7, m));
+
+	pattern_truncate(&patterns[1], 5, ROWS - 2);
+	CHECK(patterns[1].column_lengths[5] == ROWS - 2);
+	CHECK(pattern_append(&patterns[0], 0, m));				// Freed by another pattern
+	CHECK(pattern_append(&patterns[1], 5, m));
+	CHECK(!pattern_append(&patterns[1], 5, m));
+}
+
+static void test_switch() {
+	unsigned char notes[ROWS];
+
+	pattern_init();
+	pattern_set_length(&patterns[0], 4);
+	pattern_set_length(&patterns[1], 4);
+	note(0, 0, 60);
+	note(0, 3, 63);
+	note(1, 0, 70);
+	note(1, 2, 72);
+	channel_mask = 0xFFFF;
+	clock_out = 0;
+	PR2 = 3254;													// 120 BPM, room for every note
+	start_playback(1);
+
+	CHECK(host_play_step(notes, ROWS) == 1 && notes[0] == 60);
+	host_play_step(notes, ROWS);
+	midi_message_received(0xC0, 1, 0);						// Queued, not switched yet
+	CHECK(queued_pattern == 1 && current_pattern == &patterns[0]);
+	CHECK(host_play_step(notes, ROWS) == 0);				// Column 2 of pattern 0 is empty
+	CHECK(host_play_step(notes, ROWS) == 1 && notes[0] == 63);
+	CHECK(current_pattern == &patterns[0]);
+
+	CHECK(host_play_step(notes, ROWS) == 1 && notes[0] == 70);	// Switched at the wrap
+	CHECK(current_pattern == &patterns[1] && current_column == 0);
+	CHECK(current_pattern->first[0] == patterns[1].first[0]);
+	host_play_step(notes, ROWS);
+	CHECK(host_play_step(notes, ROWS) == 1 && notes[0] == 72);
+
+	midi_message_received(0xC0, 1 + PATTERNS, 0);			// Numbers wrap around the banks
+	CHECK(queued_pattern == 1);
+	midi_message_received(0xC0, 0, 0);
+	host_play_step(notes, ROWS);
+	CHECK(host_play_step(notes, ROWS) == 1 && notes[0] == 60);
+	CHECK(current_pattern == &patterns[0]);
+	stop_playback();
+}
+
+int main() {
+	test_pool();
+	test_switch();
+	return test_done("banks");
+}
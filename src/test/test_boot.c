@@ -0,0 +1,67 @@
+/* test_boot.c
+   Boot time on the core timer: the host core timer moves a count per
+   read, so every delay_us and every poll of a delay shows up in it. Boot
+   sends its first MIDI byte without waiting on any delay, the display
+   powers up afterwards over its supply settle times without a poll
+   blocking for long, and delay_us waits the microseconds it is given. */
+
+#include <stdint.h>
+#include <unistd.h>
+#include <pic32mx.h>
+#include "init.h"
+#include "display.h"
+#include "midi.h"
+#include "firmware.h"
+#include "test.h"
+
+#define FLASH_FILE "test/build/boot.flash"
+#define US(counts) ((counts) / CORE_TIMER_US)
+
+static void test_delay() {
+	unsigned int start = host_core_timer;
+	delay_us(100);
+	CHECK(US(host_core_timer - start) >= 100 && US(host_core_timer - start) <= 101);
+}
+
+static void test_boot() {
+	unsigned int start, polls = 0, longest = 0;
+
+	unlink(FLASH_FILE);
+	host_flash_open(FLASH_FILE);
+	SPI2STAT = 0x09;											// SPITBE and SPIRBF, never busy
+	clock_out = 1;
+	U1TXREG = HOST_NO_BYTE;
+	start = host_core_timer;
+	boot();
+	CHECK(U1TXREG == MIDI_START);
+	CHECK(US(host_core_timer - start) < 50);				// No delay on the way
+	CHECK(T2CON & 0x8000);
+	CHECK(!display_poll());
+
+	/* The display comes up after a millisecond and 100 ms of settling,
+	   polled as the main loop would */
+	start = host_core_timer;
+	for (;;) {
+		unsigned int before = host_core_timer;
+		int ready = display_poll();
+		if (host_core_timer - before > longest) {
+			longest = host_core_timer - before;
+		}
+		if (ready || US(host_core_timer - start) >= 200000) {
+			break;
+		}
+		host_core_timer += 10 * CORE_TIMER_US;
+		polls++;
+	}
+	CHECK(display_poll());
+	CHECK(US(host_core_timer - start) >= 101000 && US(host_core_timer - start) < 102000);
+	CHECK(polls > 10000);										// It kept returning meanwhile
+	CHECK(US(longest) < 20);									// Reset pulses and SPI bytes only
+	unlink(FLASH_FILE);
+}
+
+int main() {
+	test_delay();
+	test_boot();
+	return test_done("boot");
+}
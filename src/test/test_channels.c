@@ -0,0 +1,127 @@
+/* test_channels.c
+   Notes on every MIDI channel: recording keeps the channel of each note,
+   playback sends each channel on its own routed output channel, and mute
+   and solo leave out only the channels they name. */
+
+#include <pic32mx.h>
+#include "midi.h"
+#include "firmware.h"
+#include "test.h"
+
+static unsigned char ons[ROWS][2];						// Status and note of the note ons sent
+
+// Plays the next step and keeps its note ons, returns their number
+static int step() {
+	unsigned char bytes[256];
+	int i, n, count = 0;
+	clock_ticks += CLOCKS_PER_STEP;
+	time_counter = CLOCKS_PER_STEP;
+	play_step();
+	while ((n = host_midi_out(bytes, sizeof(bytes))) > 0) {
+		for (i = 0; i + 2 < n; i += 3) {
+			if ((bytes[i] & 0xF0) == 0x90 && bytes[i + 2] && count < ROWS) {
+				ons[count][0] = bytes[i];
+				ons[count++][1] = bytes[i + 1];
+			}
+		}
+	}
+	return count;
+}
+
+// 1 if the note ons of the last step hold status with note
+static int sent(int count, unsigned char status, unsigned char note) {
+	int i;
+	for (i = 0; i < count; i++) {
+		if (ons[i][0] == status && ons[i][1] == note) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Plays a whole loop of four columns and returns the note ons of its first
+static int loop() {
+	int count = step();
+	step();
+	step();
+	step();
+	return count;
+}
+
+static void test_record() {
+	static const unsigned char channel_of[3] = {0x90, 0x93, 0x9F};	// Of notes 60 to 62
+	unsigned short e;
+	int count = 0;
+
+	pattern_init();
+	pattern_set_length(current_pattern, 4);
+	channel_mask = 0xFFFF;
+	channels_used = 0;
+	clock_out = 0;
+	PR2 = 3254;
+	record = 1;
+	start_playback(1);
+	step();
+	midi_message_received(0x90, 60, 100);
+	midi_message_received(0x93, 61, 100);
+	midi_message_received(0x9F, 62, 100);
+	clock_ticks += 2;
+	midi_message_received(0x80, 60, 0);
+	midi_message_received(0x93, 61, 0);						// Note on with velocity 0
+	midi_message_received(0x8F, 62, 0);
+	record = 0;
+	CHECK(channels_used == (1 << 0 | 1 << 3 | 1 << 15));
+
+	for (e = current_pattern->first[0]; e != NO_EVENT; e = events[e].next) {
+		CHECK(events[e].msg.command == channel_of[events[e].msg.note - 60]);
+		CHECK(events[e].msg.duration == 2);
+		count++;
+	}
+	CHECK(count == 3);
+
+	step();
+	step();
+	step();
+	count = loop();
+	CHECK(count == 3);
+	CHECK(sent(count, 0x90, 60) && sent(count, 0x93, 61) && sent(count, 0x9F, 62));
+}
+
+static void test_route() {
+	int count;
+	control_change(3, 24, 9);									// Channel 4 out on 10
+	count = loop();
+	CHECK(count == 3);
+	CHECK(sent(count, 0x90, 60) && sent(count, 0x99, 61) && sent(count, 0x9F, 62));
+	control_change(3, 24, 3);
+}
+
+static void test_mute_solo() {
+	int count;
+	control_change(3, 22, 127);								// Mute channel 4
+	count = loop();
+	CHECK(count == 2 && !sent(count, 0x93, 61));
+
+	control_change(15, 23, 127);							// Solo channel 16, over the mute
+	count = loop();
+	CHECK(count == 1 && sent(count, 0x9F, 62));
+	control_change(0, 23, 127);
+	count = loop();
+	CHECK(count == 2 && sent(count, 0x90, 60) && sent(count, 0x9F, 62));
+
+	control_change(15, 23, 0);
+	control_change(0, 23, 0);									// No solo left, the mute again
+	count = loop();
+	CHECK(count == 2 && !sent(count, 0x93, 61));
+	control_change(3, 22, 0);
+	count = loop();
+	CHECK(count == 3);
+	stop_playback();
+}
+
+int main() {
+	test_record();
+	test_route();
+	test_mute_solo();
+	return test_done("channels");
+}
@@ -0,0 +1,90 @@
+/* test_clock.c
+   The MIDI clock master: Timer2 counts at TIMER2_HZ and its period gives
+   24 clocks a beat over the whole tempo range, each Timer2 tick sends a
+   timing clock, start and stop go out with playback, and a real-time byte
+   that finds the transmit FIFO full goes out before anything queued. */
+
+#include <stdlib.h>
+#include <pic32mx.h>
+#include "init.h"
+#include "midi.h"
+#include "firmware.h"
+#include "test.h"
+
+// Timer2 counts in a beat at the period, against the counts a beat takes
+static int beat_error(int period, int bpm) {
+	return abs((period + 1) * 24 * bpm - TIMER2_HZ * 60);
+}
+
+static void test_timer() {
+	timer_init();
+	CHECK(((T2CON >> 4) & 7) == 7);						// TCKPS 1:256
+	CHECK(TIMER2_HZ == PBCLK / 256);
+	CHECK(beat_error(PR2, 120) <= 24 * 120);		// Within a count of 120 BPM
+}
+
+static void test_tempo() {
+	int bpm;
+	for (bpm = 40; bpm <= 295; bpm++) {
+		AD1CON1 = 3;											// Sampled and converted
+		ADC1BUF0 = (bpm - 40) << 2;
+		next_period = 0;
+		update_tempo();
+		CHECK(tempo == bpm);
+		CHECK(next_period > 0 && next_period <= 0xFFFF);
+		CHECK(beat_error(next_period, bpm) <= 24 * bpm);
+	}
+}
+
+static void test_transport() {
+	unsigned char bytes[256];
+
+	clock_out = 1;
+	channels_used = 0;										// No note offs after the stop
+	U1TXREG = HOST_NO_BYTE;
+	timer2_isr();
+	CHECK(U1TXREG == MIDI_CLOCK);
+
+	U1TXREG = HOST_NO_BYTE;
+	start_playback(1);
+	CHECK(U1TXREG == MIDI_START && play);
+	host_midi_out(bytes, sizeof(bytes));
+	U1TXREG = HOST_NO_BYTE;
+	stop_playback();
+	CHECK(U1TXREG == MIDI_STOP && !play);
+
+	clock_out = 0;
+	U1TXREG = HOST_NO_BYTE;
+	timer2_isr();
+	start_playback(1);
+	stop_playback();
+	CHECK(U1TXREG == HOST_NO_BYTE);
+	host_midi_out(bytes, sizeof(bytes));
+	clock_out = 1;
+}
+
+static void test_realtime_queue() {
+	unsigned char bytes[16];
+	struct message m = {0x91, 60, 100, 1};
+
+	U1STA = PIC32_USTA_UTXBF;								// The FIFO is full
+	send_midi_message(m);
+	midi_realtime(MIDI_STOP);
+	midi_realtime(MIDI_CLOCK);
+	U1STA = 0;
+	CHECK(host_midi_out(bytes, sizeof(bytes)) == 5);
+	CHECK(bytes[0] == MIDI_STOP && bytes[1] == MIDI_CLOCK);	// In order, before the message
+	CHECK(bytes[2] == 0x91 && bytes[3] == 60 && bytes[4] == 100);
+
+	midi_song_position(200);
+	CHECK(host_midi_out(bytes, sizeof(bytes)) == 3);
+	CHECK(bytes[0] == MIDI_SONG_POSITION && bytes[1] == (200 & 0x7F) && bytes[2] == 200 >> 7);
+}
+
+int main() {
+	test_timer();
+	test_tempo();
+	test_transport();
+	test_realtime_queue();
+	return test_done("clock");
+}
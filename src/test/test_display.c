@@ -0,0 +1,133 @@
+/* test_display.c
+   Display text: numbers, tenths and note names written straight into the
+   text buffer, and the cells that changed going out to the display as the
+   column bytes of their glyphs, in the 8x8 font and the condensed one,
+   each run of changed cells after a cursor of its own. */
+
+#include <stdint.h>
+#include <string.h>
+#include <pic32mx.h>
+#include "display.h"
+#include "test.h"
+
+static void clear(int row) {
+	memset(textbuffer[row], ' ', TEXT_COLUMNS);
+}
+
+static int same(int row, int col, const char *text) {
+	return !memcmp(&textbuffer[row][col], text, strlen(text));
+}
+
+static void test_format() {
+	clear(0);
+	CHECK(display_number(0, 0, 1234) == 4 && same(0, 0, "1234 "));
+	CHECK(display_number(0, 5, 1005) == 9 && same(0, 5, "1005"));
+	CHECK(display_number(0, 10, -7) == 12 && same(0, 10, "-7 "));
+	clear(0);
+	CHECK(display_number(0, 0, 0) == 1 && same(0, 0, "0 "));
+	CHECK(display_number(0, 2, 99) == 4 && same(0, 2, "99 "));
+	CHECK(display_number(0, 5, 1000000) == 12 && same(0, 5, "1000000"));
+	clear(0);
+	CHECK(display_number(0, 14, 12345) == 19 && same(0, 14, "12"));	// Clipped at the row end
+
+	clear(1);
+	CHECK(display_tenths(1, 0, 1205) == 5 && same(1, 0, "120.5 "));
+	CHECK(display_tenths(1, 6, 5) == 9 && same(1, 6, "0.5 "));
+	CHECK(display_tenths(1, 10, -15) == 14 && same(1, 10, "-1.5"));
+	clear(1);
+	CHECK(display_tenths(1, 13, 1205) == 18 && same(1, 13, "120"));
+
+	clear(2);
+	CHECK(display_note(2, 0, 61) == 3 && same(2, 0, "C#4 "));
+	CHECK(display_note(2, 4, 0) == 7 && same(2, 4, "C-1 "));
+	CHECK(display_note(2, 8, 127) == 10 && same(2, 8, "G9 "));
+}
+
+// The bytes sent since host_spi_count was cleared, without the reads
+static int sent(unsigned char *bytes) {
+	int i, n = 0;
+	for (i = 0; i < host_spi_count; i++) {
+		if (host_spi[i] != HOST_NO_BYTE) {
+			bytes[n++] = host_spi[i];
+		}
+	}
+	return n;
+}
+
+static void test_render() {
+	static const unsigned char a[8] = {0, 0, 126, 9, 9, 126, 0, 0};
+	static const unsigned char zero[8] = {0, 62, 65, 73, 65, 62, 0, 0};
+	static const unsigned char a_condensed[4] = {0x78, 0x14, 0x78, 0};
+	unsigned char bytes[1024];
+	int n;
+
+	SPI2STAT = 0x09;											// SPITBE and SPIRBF, never busy
+	display_init();
+	while (!display_poll()) {
+	}
+	clear(3);
+	display_update();
+
+	host_spi_count = 0;
+	textbuffer[3][5] = 'A';
+	display_update();
+	n = sent(bytes);
+	CHECK(n == 5 + 8);										// Cursor, then the one cell
+	CHECK(bytes[0] == 0x22 && bytes[1] == 3 && bytes[3] == (40 & 0xF) && bytes[4] == (0x10 | 40 >> 4));
+	CHECK(!memcmp(&bytes[n - 8], a, 8));
+
+	host_spi_count = 0;
+	textbuffer[3][6] = '0';
+	textbuffer[3][7] = 'A';
+	display_update();
+	n = sent(bytes);
+	CHECK(n >= 16 && !memcmp(&bytes[n - 16], zero, 8) && !memcmp(&bytes[n - 8], a, 8));
+
+	display_condensed(3, 1);									// The whole row again, 4 columns a cell
+	host_spi_count = 0;
+	display_update();
+	n = sent(bytes);
+	CHECK(n >= 128 && !memcmp(&bytes[n - 128 + 5 * 4], a_condensed, 4));
+	display_condensed(3, 0);
+}
+
+// Only the cells that changed go out, a run of them after one cursor
+static void test_diff() {
+	unsigned char bytes[1024];
+
+	clear(1);
+	clear(2);
+	display_update();
+	host_spi_count = 0;
+	display_update();
+	CHECK(sent(bytes) == 0);
+
+	display_number(1, 4, 120);
+	display_update();
+	host_spi_count = 0;
+	display_number(1, 4, 120);								// The same number again
+	display_update();
+	CHECK(sent(bytes) == 0);
+
+	display_number(1, 4, 121);								// One digit changed
+	display_update();
+	CHECK(sent(bytes) == 5 + 8);
+
+	host_spi_count = 0;
+	textbuffer[1][0] = 'X';
+	textbuffer[1][12] = 'Y';
+	textbuffer[2][3] = 'Z';
+	textbuffer[2][4] = 'Z';
+	display_update();
+	CHECK(sent(bytes) == 3 * 5 + 4 * 8);					// Three runs of 1, 1 and 2 cells
+	CHECK(bytes[0] == 0x22 && bytes[1] == 1);
+	CHECK(bytes[13] == 0x22 && bytes[14] == 1 && bytes[16] == (96 & 0xF));
+	CHECK(bytes[26] == 0x22 && bytes[27] == 2 && bytes[29] == (24 & 0xF) && bytes[30] == (0x10 | 24 >> 4));
+}
+
+int main() {
+	test_format();
+	test_render();
+	test_diff();
+	return test_done("display");
+}
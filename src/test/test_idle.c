@@ -0,0 +1,63 @@
+/* test_idle.c
+   The busy measure on virtual Timer1 counts: each idle tick the CPU runs
+   for a share of the tick and waits for the rest, and after about a
+   second cpu_busy gives that share, playing and with the slower tick of
+   pause. Idle passes that may not wait do not. */
+
+#include <stdlib.h>
+#include <pic32mx.h>
+#include "init.h"
+#include "idle.h"
+#include "test.h"
+
+// Runs ticks idle ticks busy percent of each, waiting out the rest
+static void run(int ticks, int busy) {
+	int i;
+	for (i = 0; i < ticks; i++) {
+		unsigned int period = PR1 + 1;
+		TMR1 = period * busy / 100;
+		host_wait_counts = period - 1 - TMR1;				// Wakes on the last count of the tick
+		idle(1);
+		idle(0);												// Woken by something else, nothing to do
+		idle_tick_isr();
+	}
+	idle(0);
+}
+
+static void test_playing() {
+	int busy;
+	idle_init();
+	idle_paused(0);
+	run(100, 30);
+	CHECK(abs(cpu_busy - 30) <= 1);
+	run(100, 85);
+	CHECK(abs(cpu_busy - 85) <= 1);
+	busy = cpu_busy;
+	run(50, 0);
+	CHECK(cpu_busy == busy);									// Half a second, not measured yet
+	run(50, 0);
+	CHECK(cpu_busy <= 1);
+}
+
+static void test_paused() {
+	unsigned int playing_period = PR1 + 1;
+	idle_paused(1);
+	CHECK(PR1 + 1 == PBCLK / 256 / 25);					// 25 ticks a second instead of 100
+	run(25, 5);
+	CHECK(abs(cpu_busy - 5) <= 1);
+	idle_paused(0);
+	CHECK(PR1 + 1 == playing_period);
+}
+
+static void test_no_wait() {
+	int waits = host_waits;
+	idle(0);
+	CHECK(host_waits == waits);
+}
+
+int main() {
+	test_playing();
+	test_paused();
+	test_no_wait();
+	return test_done("idle");
+}
@@ -0,0 +1,99 @@
+/* test_leds.c
+   Step LEDs: the bit planes of a frame light each LED for its level in
+   sevenths of the frame, fully on or off needs no planes, and playback
+   puts the LED of a step on the port before the first MIDI byte of the
+   step goes out, fully lit when the step has an accent. */
+
+#include <pic32mx.h>
+#include "leds.h"
+#include "midi.h"
+#include "firmware.h"
+#include "test.h"
+
+#define T3_ON 0x8000
+
+// Shortest planes each of the LEDs is lit for over a frame
+static void frame(int *lit) {
+	int i, led, unit = 0;
+	for (led = 0; led < 8; led++) {
+		lit[led] = 0;
+	}
+	for (i = 0; i < 3; i++) {
+		leds_pwm_isr();
+		if (!unit) {
+			unit = PR3 + 1;										// The first is plane 0
+		}
+		for (led = 0; led < 8; led++) {
+			lit[led] += (PORTE >> led & 1) * (PR3 + 1) / unit;
+		}
+	}
+}
+
+static void test_levels() {
+	int lit[8];
+	int level, background, led, same = 1;
+
+	leds_init();
+	for (level = 1; level < LED_LEVELS; level++) {
+		for (background = 0; background < level; background++) {
+			leds_set(0x81, level, background);
+			leds_pwm_isr();											// On plane 2, so the frame starts at 0
+			leds_pwm_isr();
+			if (level == LED_LEVELS - 1 && background == 0) {
+				continue;											// Nothing dimmed, see below
+			}
+			frame(lit);
+			for (led = 0; led < 8; led++) {
+				same &= lit[led] == ((led == 0 || led == 7) ? level : background);
+			}
+		}
+	}
+	CHECK(same);
+
+	T3CONCLR = 0;
+	PORTE = 0;
+	leds_set(0x10, LED_LEVELS - 1, 0);
+	CHECK(PORTE == 0x10 && T3CONCLR == T3_ON);				// Written once, Timer3 stopped
+	leds_set(0x10, 0, 0);
+	CHECK(PORTE == 0);
+}
+
+static void test_step() {
+	unsigned char bytes[256];
+	int column, level;
+
+	pattern_init();
+	pattern_set_length(current_pattern, 8);
+	for (column = 0; column < 8; column++) {
+		struct message m = {0x90, 60, column == 5 ? 120 : 60, 1, 0, CLOCKS_PER_STEP, 0};
+		pattern_append(current_pattern, column, m);
+	}
+	channel_mask = 0xFFFF;
+	clock_out = 0;
+	PR2 = 3254;
+	record = 0;
+	start_playback(1);
+	for (column = 0; column < 8; column++) {
+		while (host_midi_out(bytes, sizeof(bytes))) {
+		}
+		clock_ticks += CLOCKS_PER_STEP;
+		time_counter = CLOCKS_PER_STEP;
+		T3CONCLR = 0;
+		play_step();
+		CHECK(midi_queued() > 0);								// The step's bytes not sent yet
+		CHECK(PORTE == 1 << (7 - column));
+		level = (column == 5) ? LED_ACCENT : (column & 3) ? LED_STEP : LED_BEAT;
+		CHECK((T3CONCLR == T3_ON) == (level == LED_ACCENT));	// Fully lit needs no planes
+	}
+	stop_playback();
+
+	PORTE = 0x55;
+	update_tempo();
+	CHECK(PORTE == 0x55);										// Only the step engine writes the LEDs
+}
+
+int main() {
+	test_levels();
+	test_step();
+	return test_done("leds");
+}
@@ -0,0 +1,102 @@
+/* test_noteoff.c
+   The note off heap of noteoff.c: each note off goes out on the tick it
+   is due, in order of the ticks and across the wrap of the tick count, a
+   retriggered note ends before it starts again, and a full heap makes
+   room by ending the note due first. */
+
+#include <string.h>
+#include "noteoff.h"
+#include "test.h"
+
+static unsigned int seed = 5;
+
+static unsigned int next_random() {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+/* Sends what is due at now, returns the number of note offs and keeps
+   their notes */
+static int service(unsigned int now, unsigned char *notes) {
+	unsigned char bytes[3 * NOTEOFF_SLOTS];
+	int i, n;
+	noteoff_service(now);
+	n = host_midi_out(bytes, sizeof(bytes));
+	CHECK(n % 3 == 0);
+	for (i = 0; i < n; i += 3) {
+		CHECK((bytes[i] & 0xF0) == 0x80 && bytes[i + 2] == 0);
+		notes[i / 3] = bytes[i + 1];
+	}
+	return n / 3;
+}
+
+/* Schedules a full heap at random ticks from start and checks that each
+   note off comes out on its own tick, nothing before and nothing after */
+static void test_order(unsigned int start) {
+	unsigned int due[NOTEOFF_SLOTS];
+	unsigned char notes[NOTEOFF_SLOTS];
+	int i, k, n, sent = 0;
+	unsigned int t;
+
+	for (i = 0; i < NOTEOFF_SLOTS; i++) {
+		due[i] = start + 1 + next_random() % 200;
+		noteoff_start(0, i, due[i]);
+	}
+	for (t = start; t != start + 202; t++) {
+		n = service(t, notes);
+		for (k = 0; k < n; k++) {
+			CHECK(notes[k] < NOTEOFF_SLOTS && due[notes[k]] == t);
+		}
+		for (i = 0; i < NOTEOFF_SLOTS; i++) {			// Nothing due is left behind
+			if (due[i] == t) {
+				for (k = 0; k < n && notes[k] != i; k++) {
+				}
+				CHECK(k < n);
+			}
+		}
+		sent += n;
+	}
+	CHECK(sent == NOTEOFF_SLOTS);
+}
+
+static void test_retrigger() {
+	unsigned char bytes[16];
+	unsigned char notes[NOTEOFF_SLOTS];
+
+	noteoff_start(3, 60, 100);
+	CHECK(host_midi_out(bytes, sizeof(bytes)) == 0);
+	noteoff_start(3, 60, 120);							// Starts again while it sounds
+	CHECK(host_midi_out(bytes, sizeof(bytes)) == 3 && bytes[0] == 0x83 && bytes[1] == 60);
+	noteoff_start(4, 60, 90);								// The same note on another channel is its own
+	CHECK(host_midi_out(bytes, sizeof(bytes)) == 0);
+	CHECK(service(100, notes) == 1 && notes[0] == 60);
+	CHECK(service(119, notes) == 0);
+	CHECK(service(120, notes) == 1);
+}
+
+static void test_full() {
+	unsigned char bytes[3 * NOTEOFF_SLOTS + 3];
+	unsigned char notes[NOTEOFF_SLOTS];
+	int i;
+
+	for (i = 0; i < NOTEOFF_SLOTS; i++) {
+		noteoff_start(0, i, 1000 - i);
+	}
+	CHECK(host_midi_out(bytes, sizeof(bytes)) == 0);
+	noteoff_start(0, 100, 2000);
+	CHECK(host_midi_out(bytes, sizeof(bytes)) == 3 && bytes[1] == NOTEOFF_SLOTS - 1);	// Due first
+	CHECK(service(1000 - NOTEOFF_SLOTS + 1, notes) == 0);
+	CHECK(service(1000 - NOTEOFF_SLOTS + 2, notes) == 1 && notes[0] == NOTEOFF_SLOTS - 2);
+
+	noteoff_flush();
+	CHECK(host_midi_out(bytes, sizeof(bytes)) == 3 * (NOTEOFF_SLOTS - 1) && bytes[0] == 0x80);
+	CHECK(service(5000, notes) == 0);
+}
+
+int main() {
+	test_order(0);
+	test_order(0xFFFFFFFF - 100);						// Due ticks wrap round
+	test_retrigger();
+	test_full();
+	return test_done("noteoff");
+}
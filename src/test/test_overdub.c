@@ -0,0 +1,120 @@
+/* test_overdub.c
+   Overdub modes while playing: replace takes out the notes of the same
+   pitch and channel on the step a new note lands on, erase takes out the
+   pitches of held keys as the playhead passes, and an undo afterwards
+   takes back what was recorded but does not bring removed notes back. */
+
+#include <unistd.h>
+#include <pic32mx.h>
+#include "midi.h"
+#include "storage.h"
+#include "firmware.h"
+#include "test.h"
+
+#define FLASH_FILE "test/build/overdub.flash"
+
+static void note(int column, int channel, int n, int velocity) {
+	struct message m = {0x90 | channel, n, velocity, 1, 0, CLOCKS_PER_STEP, 0};
+	pattern_append(current_pattern, column, m);
+}
+
+// The notes of channel in column, as a bit per note from 60
+static unsigned int notes_in(int column, int channel) {
+	unsigned int bits = 0;
+	unsigned short e;
+	for (e = current_pattern->first[column]; e != NO_EVENT; e = events[e].next) {
+		if ((events[e].msg.command & 0xF) == channel) {
+			bits |= 1 << (events[e].msg.note - 60);
+		}
+	}
+	return bits;
+}
+
+// A note on the step playing, let go two clock ticks later
+static void play_note(int channel, int n, int velocity) {
+	midi_message_received(0x90 | channel, n, velocity);
+	clock_ticks += 2;
+	midi_message_received(0x80 | channel, n, 0);
+}
+
+static void setup(int mode) {
+	unlink(FLASH_FILE);
+	host_flash_open(FLASH_FILE);
+	pattern_init();
+	storage_load();
+	pattern_set_length(current_pattern, 4);
+	channel_mask = 0xFFFF;
+	clock_out = 0;
+	PR2 = 3254;
+	control_change(0, 38, mode * 32);
+	record = 1;
+}
+
+static void test_replace() {
+	unsigned char notes[ROWS];
+	unsigned short e;
+
+	setup(1);
+	note(0, 0, 60, 50);
+	note(0, 0, 64, 50);
+	note(0, 1, 60, 50);
+	reset_undo();
+	start_playback(1);
+	host_play_step(notes, ROWS);
+	play_note(0, 60, 100);
+	CHECK(current_pattern->column_lengths[0] == 3);
+	CHECK(notes_in(0, 0) == (1 << 0 | 1 << 4) && notes_in(0, 1) == 1 << 0);	// The other channel kept
+	for (e = current_pattern->first[0]; e != NO_EVENT; e = events[e].next) {
+		CHECK(events[e].msg.velocity == ((events[e].msg.command & 0xF) == 0 &&
+				events[e].msg.note == 60 ? 100 : 50));
+	}
+
+	host_play_step(notes, ROWS);
+	play_note(0, 61, 100);									// Nothing of its pitch there
+	CHECK(current_pattern->column_lengths[1] == 1);
+
+	save_column_lengths();
+	undo();
+	CHECK(current_pattern->column_lengths[0] == 2);		// The new 60 is gone, the old one too
+	CHECK(notes_in(0, 0) == 1 << 4 && notes_in(0, 1) == 1 << 0);
+	CHECK(current_pattern->column_lengths[1] == 0);
+	stop_playback();
+}
+
+static void test_erase() {
+	unsigned char notes[ROWS];
+	int column;
+
+	setup(2);
+	for (column = 0; column < 4; column++) {
+		note(column, 0, 60, 100);
+	}
+	note(2, 0, 62, 100);
+	note(3, 1, 60, 100);
+	reset_undo();
+	start_playback(1);
+	CHECK(host_play_step(notes, ROWS) == 1);
+	midi_message_received(0x90, 60, 100);					// Held from column 0 on
+	CHECK(current_pattern->column_lengths[0] == 1);		// Only where the playhead goes next
+	CHECK(host_play_step(notes, ROWS) == 0);
+	CHECK(host_play_step(notes, ROWS) == 1 && notes[0] == 62);
+	CHECK(host_play_step(notes, ROWS) == 1);				// Channel 2 keeps its 60
+	midi_message_received(0x80, 60, 0);
+	CHECK(host_play_step(notes, ROWS) == 1 && notes[0] == 60);	// Let go before the wrap
+	CHECK(notes_in(0, 0) == 1 && !notes_in(1, 0) && notes_in(2, 0) == 1 << 2 && !notes_in(3, 0));
+	CHECK(notes_in(3, 1) == 1);
+
+	save_column_lengths();
+	undo();
+	CHECK(notes_in(0, 0) == 1 && !notes_in(1, 0) && notes_in(2, 0) == 1 << 2);	// Not brought back
+	CHECK(notes_in(3, 1) == 1);
+	stop_playback();
+	record = 0;
+}
+
+int main() {
+	test_replace();
+	test_erase();
+	unlink(FLASH_FILE);
+	return test_done("overdub");
+}
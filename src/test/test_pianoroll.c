@@ -0,0 +1,123 @@
+/* test_pianoroll.c
+   The framebuffer spans, a piano roll drawn from a pattern with notes
+   wrapping past its end, and flushes that send only the columns that
+   changed, also when the playhead moves. The roll is also written to
+   test/build/pianoroll.pbm to look at. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pic32mx.h>
+#include "display.h"
+#include "framebuffer.h"
+#include "pianoroll.h"
+#include "midi.h"
+#include "test.h"
+
+static int lit(int x, int y) {
+	return (framebuffer[x] >> y) & 1;
+}
+
+// The bytes sent since host_spi_count was cleared, without the reads
+static int sent() {
+	int i, n = 0;
+	for (i = 0; i < host_spi_count; i++) {
+		n += host_spi[i] != HOST_NO_BYTE;
+	}
+	return n;
+}
+
+static void write_pbm(const char *path) {
+	FILE *f = fopen(path, "w");
+	int x, y;
+	if (!f) {
+		return;
+	}
+	fprintf(f, "P1\n%d %d\n", FB_WIDTH, FB_HEIGHT);
+	for (y = 0; y < FB_HEIGHT; y++) {
+		for (x = 0; x < FB_WIDTH; x++) {
+			fputc(lit(x, y) ? '1' : '0', f);
+		}
+		fputc('\n', f);
+	}
+	fclose(f);
+}
+
+static void test_spans() {
+	fb_clear();
+	fb_vspan(3, 2, 5);
+	CHECK(framebuffer[3] == 0x3C);
+	fb_vspan(4, 0, 31);
+	CHECK(framebuffer[4] == 0xFFFFFFFF);
+	fb_vspan(5, -3, 40);										// Clipped
+	CHECK(framebuffer[5] == 0xFFFFFFFF);
+	fb_vspan(6, 9, 8);
+	CHECK(framebuffer[6] == 0);
+	fb_hspan(7, 120, 200);
+	CHECK(lit(120, 7) && lit(127, 7) && !lit(119, 7));
+	fb_clear();
+}
+
+static void note(int column, int n, int steps) {
+	struct message m = {0x90, n, 100, 1, 0, steps * CLOCKS_PER_STEP, 0};
+	pattern_append(current_pattern, column, m);
+}
+
+/* 16 steps of 8 pixels. Notes 60 and 72 are centred in the 31 note rows,
+   starting from 51 at the bottom. */
+static void test_draw() {
+	int x;
+	pattern_init();
+	pattern_set_length(current_pattern, 16);
+	note(4, 60, 2);
+	note(15, 72, 2);											// Sounds past the end
+	pianoroll_draw(current_pattern);
+	write_pbm("test/build/pianoroll.pbm");
+
+	for (x = 32; x < 48; x++) {
+		CHECK(lit(x, 21) && !lit(x, 9));
+	}
+	CHECK(!lit(31, 21) && !lit(48, 21));
+	for (x = 0; x < 8; x++) {
+		CHECK(lit(120 + x, 9) && lit(x, 9));					// Wrapped to the start
+	}
+	CHECK(!lit(8, 9) && !lit(119, 9));
+	CHECK(lit(0, 31) && lit(32, 31) && lit(64, 31) && lit(96, 31));	// Beats
+	CHECK(!lit(8, 31) && !lit(16, 31));
+}
+
+static void test_flush() {
+	SPI2STAT = 0x09;											// SPITBE and SPIRBF, never busy
+	display_init();
+	while (!display_poll()) {
+	}
+	fb_invalidate();
+	fb_flush();
+	host_spi_count = 0;
+	fb_flush();
+	CHECK(sent() == 0);
+
+	pianoroll_draw(current_pattern);							// Unchanged, nothing to send
+	fb_flush();
+	CHECK(sent() == 0);
+
+	pianoroll_playhead(0, 16);
+	fb_flush();
+	CHECK(sent() == 4 * (5 + 8));								// Columns 0 to 7 on every page
+	host_spi_count = 0;
+	pianoroll_playhead(1, 16);
+	fb_flush();
+	CHECK(sent() == 4 * (5 + 16));								// The columns left and entered, one run
+
+	host_spi_count = 0;
+	note(8, 62, 1);
+	pianoroll_draw(current_pattern);
+	fb_flush();
+	CHECK(sent() == 4 * (5 + 8));								// The new note's columns
+}
+
+int main() {
+	test_spans();
+	test_draw();
+	test_flush();
+	return test_done("pianoroll");
+}
@@ -0,0 +1,96 @@
+/* test_song.c
+   Song mode: program changes while paused with record on build the song,
+   a pattern entered again in a row adds a repeat, and playing the song
+   switches pattern after the repeats of each entry, going back to the
+   first entry after the last. A program change while playing leaves the
+   song. */
+
+#include <pic32mx.h>
+#include "midi.h"
+#include "song.h"
+#include "firmware.h"
+#include "test.h"
+
+// Plays loops of two columns, keeping the pattern each one started with
+static void play_loops(int *played, int loops) {
+	unsigned char notes[ROWS];
+	int i;
+	for (i = 0; i < loops; i++) {
+		played[i] = -1;
+		if (host_play_step(notes, ROWS) == 1) {
+			played[i] = notes[0] - 60;
+		}
+		host_play_step(notes, ROWS);						// The second column
+	}
+}
+
+static void test_append() {
+	int i;
+	song_clear();
+	record = 1;
+	play = 0;
+	midi_message_received(0xC0, 0, 0);
+	midi_message_received(0xC0, 0, 0);
+	midi_message_received(0xC0, 1, 0);
+	midi_message_received(0xC0, 2 + PATTERNS, 0);
+	CHECK(song_length == 3);
+	CHECK(song[0].pattern == 0 && song[0].repeats == 2);
+	CHECK(song[1].pattern == 1 && song[1].repeats == 1);
+	CHECK(song[2].pattern == 2 && song[2].repeats == 1);
+	CHECK(queued_pattern == 0 && !song_active);			// Nothing queued while editing
+
+	song_clear();
+	for (i = 0; i < 300; i++) {
+		song_append(3);
+	}
+	CHECK(song_length == 2 && song[0].repeats == 0xFF && song[1].repeats == 300 - 0xFF);
+	for (i = 0; i < SONG_LENGTH + 5; i++) {
+		song_append(i % 2);
+	}
+	CHECK(song_length == SONG_LENGTH);						// Full, the rest is dropped
+}
+
+static void test_chain() {
+	static const int expected[] = {0, 0, 1, 2, 2, 2, 0, 0, 1};
+	int played[9];
+	int p, i;
+
+	pattern_init();
+	for (p = 0; p < 3; p++) {
+		struct message m = {0x90, 60 + p, 100, 1, 0, CLOCKS_PER_STEP, 0};
+		pattern_set_length(&patterns[p], 2);
+		pattern_append(&patterns[p], 0, m);
+	}
+	song_clear();
+	song_append(0);
+	song_append(0);
+	song_append(1);
+	song_append(2);
+	song_append(2);
+	song_append(2);
+
+	channel_mask = 0xFFFF;
+	clock_out = 0;
+	PR2 = 3254;
+	record = 0;
+	queued_pattern = 1;
+	current_pattern = &patterns[1];
+	song_start();
+	start_playback(1);
+	play_loops(played, 9);
+	for (i = 0; i < 9; i++) {
+		CHECK(played[i] == expected[i]);
+	}
+
+	midi_message_received(0xC0, 1, 0);						// Leaves the song
+	CHECK(!song_active);
+	play_loops(played, 3);
+	CHECK(played[0] == 1 && played[1] == 1 && played[2] == 1);
+	stop_playback();
+}
+
+int main() {
+	test_append();
+	test_chain();
+	return test_done("song");
+}
@@ -0,0 +1,97 @@
+/* test_stepedit.c
+   Step entry while paused: a note goes on the step shown, or on the column
+   its track is on when the track has a length of its own, keys still down
+   are tied into the next step, and entering a note again only changes its
+   velocity. */
+
+#include "midi.h"
+#include "stepedit.h"
+#include "track.h"
+#include "firmware.h"
+#include "test.h"
+
+// The event of note on channel in column, NO_EVENT if it is not there
+static unsigned short find(int column, int channel, int note) {
+	unsigned short e;
+	for (e = current_pattern->first[column]; e != NO_EVENT; e = events[e].next) {
+		if (events[e].msg.note == note && (events[e].msg.command & 0xF) == channel) {
+			return e;
+		}
+	}
+	return NO_EVENT;
+}
+
+/* Pattern of 16 steps with channel 1 on a track of 3, paused after 20
+   steps, so the pattern last played its column 3 and the track its
+   column 1 */
+static void setup() {
+	int step;
+	pattern_init();
+	pattern_set_length(current_pattern, 16);
+	pattern_set_track_length(current_pattern, 1, 3);
+	track_restart(current_pattern, 0);
+	for (step = 0; step < 20; step++) {
+		track_step(current_pattern, step % 16);
+	}
+	current_column = 3;
+	stepedit_release();
+}
+
+static void test_track_column() {
+	setup();
+	CHECK(stepedit_note(current_pattern, current_column, 0, 60, 100));
+	CHECK(stepedit_note(current_pattern, current_column, 1, 62, 100));
+	CHECK(find(3, 0, 60) != NO_EVENT);
+	CHECK(find(1, 1, 62) != NO_EVENT);						// Where its track is, not 3 % 3
+	CHECK(find(0, 1, 62) == NO_EVENT);
+
+	move_edit_step(1);										// Column 4, the track's column 2
+	CHECK(stepedit_note(current_pattern, current_column, 1, 64, 100));
+	CHECK(find(2, 1, 64) != NO_EVENT);
+	move_edit_step(1);										// Column 5, the track wraps to 0
+	CHECK(stepedit_note(current_pattern, current_column, 1, 65, 100));
+	CHECK(find(0, 1, 65) != NO_EVENT);
+	move_edit_step(-1);
+	move_edit_step(-1);										// Back on column 3, the track's 1
+	CHECK(current_column == 3);
+	CHECK(stepedit_note(current_pattern, current_column, 1, 67, 100));
+	CHECK(find(1, 1, 67) != NO_EVENT);
+}
+
+static void test_tie() {
+	unsigned short e;
+	setup();
+	CHECK(stepedit_note(current_pattern, current_column, 0, 60, 100));
+	CHECK(stepedit_note(current_pattern, current_column, 0, 64, 100));
+	CHECK(!stepedit_note(current_pattern, current_column, 0, 64, 0));	// Let go before the move
+	move_edit_step(1);
+	move_edit_step(1);
+	e = find(3, 0, 60);
+	CHECK(e != NO_EVENT && events[e].msg.duration == 3 * CLOCKS_PER_STEP);
+	e = find(3, 0, 64);
+	CHECK(e != NO_EVENT && events[e].msg.duration == CLOCKS_PER_STEP);
+	CHECK(find(4, 0, 60) == NO_EVENT);						// Tied, not entered again
+
+	move_edit_step(-1);										// Moving back ends the tie
+	move_edit_step(1);
+	e = find(3, 0, 60);
+	CHECK(events[e].msg.duration == 3 * CLOCKS_PER_STEP);
+}
+
+static void test_again() {
+	setup();
+	CHECK(stepedit_note(current_pattern, current_column, 0, 60, 100));
+	CHECK(!stepedit_note(current_pattern, current_column, 0, 60, 0));
+	CHECK(stepedit_note(current_pattern, current_column, 0, 60, 30));
+	CHECK(current_pattern->column_lengths[3] == 1);
+	CHECK(events[find(3, 0, 60)].msg.velocity == 30);
+}
+
+int main() {
+	record = 1;
+	play = 0;
+	test_track_column();
+	test_tie();
+	test_again();
+	return test_done("stepedit");
+}
@@ -0,0 +1,299 @@
+/* test_storage.c
+   The flash log of storage.c on the file backed flash driver: a bank
+   survives a power cycle, a save cut short at any word leaves every slot
+   at its old or its new contents, a record with a bad CRC falls back to
+   the copy before it, and live records are moved off a page before the
+   head erases it, however often the log goes round. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sequencer.h"
+#include "song.h"
+#include "storage.h"
+#include "trig.h"
+#include "flash.h"
+#include "test.h"
+
+#define FLASH_FILE "test/build/storage.flash"
+#define RECORD_MAGIC 0x5F											// See the record layout in storage.c
+
+/* Everything storage keeps, flattened so two banks compare with memcmp */
+struct bank {
+	unsigned short length[PATTERNS];
+	unsigned char track_lengths[PATTERNS][TRACKS];
+	unsigned char column_lengths[PATTERNS][COLUMNS];
+	unsigned int notes[PATTERNS][COLUMNS][ROWS];
+	int song_length;
+	struct song_entry song[SONG_LENGTH];
+};
+
+static unsigned int seed = 1;
+
+static unsigned int next_random() {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static unsigned int note_word(struct message m) {
+	return m.command << 24 | m.note << 16 | m.velocity << 9 | m.enable << 8 |
+		m.duration << 4 | m.skip | (unsigned int) m.condition << 28;
+}
+
+static void take(struct bank *b) {
+	int i, j, k;
+	unsigned short e;
+	memset(b, 0, sizeof(*b));
+	for (i = 0; i < PATTERNS; i++) {
+		b->length[i] = patterns[i].length;
+		memcpy(b->track_lengths[i], patterns[i].track_lengths, TRACKS);
+		for (j = 0; j < COLUMNS; j++) {
+			b->column_lengths[i][j] = patterns[i].column_lengths[j];
+			for (k = 0, e = patterns[i].first[j]; e != NO_EVENT; k++, e = events[e].next) {
+				b->notes[i][j][k] = note_word(events[e].msg);
+			}
+		}
+	}
+	b->song_length = song_length;
+	memcpy(b->song, song, sizeof(song));
+}
+
+static int same_column(const struct bank *a, const struct bank *b, int pattern, int column) {
+	return a->column_lengths[pattern][column] == b->column_lengths[pattern][column] &&
+		!memcmp(a->notes[pattern][column], b->notes[pattern][column], sizeof(a->notes[0][0]));
+}
+
+// Turns the power off and on again and loads the bank from flash
+static int power_cycle() {
+	host_flash_open(FLASH_FILE);
+	pattern_init();
+	song_length = 0;
+	memset(song, 0, sizeof(song));
+	return storage_load();
+}
+
+static void fresh_flash() {
+	unlink(FLASH_FILE);
+	power_cycle();
+}
+
+static unsigned char random_condition() {
+	switch (next_random() % 4) {
+		case 0:
+			return TRIG_ALWAYS;
+		case 1:
+			return TRIG_FIRST;
+		case 2:
+			return TRIG_NOT_FILL;
+	}
+	return TRIG_EVERY | 3 << 3 | 2;							// Loop 3 of every 4
+}
+
+static void add_note(int pattern, int column, int trig) {
+	struct message m = {0x90 | (next_random() & 0xF), next_random() & 0x7F, 1 + (next_random() % 127), 1,
+		0, 1 + next_random() % MAX_DURATION, 0};
+	if (trig) {
+		m.skip = next_random() % 15;
+		m.condition = random_condition();
+	}
+	if (pattern_append(&patterns[pattern], column, m)) {
+		storage_mark_dirty(pattern, column);
+	}
+}
+
+static void fill_bank(int notes, int trigs) {
+	int i;
+	for (i = 0; i < notes; i++) {
+		add_note(next_random() % PATTERNS, next_random() % COLUMNS, trigs && (i & 1));
+	}
+	for (i = 0; i < PATTERNS; i++) {
+		pattern_set_length(&patterns[i], 1 + next_random() % COLUMNS);
+		pattern_set_track_length(&patterns[i], i % TRACKS, next_random() % (TRACK_LENGTH_MAX + 1));
+		storage_mark_tracks_dirty(i);
+	}
+	storage_mark_length_dirty();
+	for (i = 0; i < SONG_LENGTH / 2; i++) {
+		song_append(next_random() % PATTERNS);
+	}
+}
+
+static void test_round_trip() {
+	struct bank saved, loaded;
+	fresh_flash();
+	fill_bank(POOL_SIZE / 2, 1);
+	take(&saved);
+	storage_save();
+	CHECK(power_cycle() > 0);
+	take(&loaded);
+	CHECK(!memcmp(&saved, &loaded, sizeof(saved)));
+
+	/* A pattern cleared to nothing stays empty */
+	int column;
+	for (column = 0; column < COLUMNS; column++) {
+		pattern_truncate(&patterns[1], column, 0);
+	}
+	storage_mark_all_dirty(1);
+	take(&saved);
+	storage_save();
+	power_cycle();
+	take(&loaded);
+	CHECK(!memcmp(&saved, &loaded, sizeof(saved)));
+}
+
+/*
+	Cuts the power after every few words of a save that rewrites the whole
+	bank with some columns changed, across row programs and page erases.
+	Each column must come back either as it was or as it became, and the
+	log must keep working after the reload.
+*/
+static void test_torn_save(int trigs) {
+	struct bank before, after, loaded, resaved;
+	int total, words, i, j, step;
+
+	seed = 7;
+	fresh_flash();
+	fill_bank(POOL_SIZE / 3, trigs);
+	storage_save();
+	take(&before);
+	for (i = 0; i < 4; i++) {
+		add_note(i % PATTERNS, i, trigs);
+	}
+	for (i = 0; i < PATTERNS; i++) {
+		storage_mark_all_dirty(i);
+	}
+	take(&after);
+	words = host_flash_written();
+	storage_save();
+	total = host_flash_written() - words;
+	CHECK(total > FLASH_PAGE_WORDS);
+
+	step = total / 200 + 1;
+	for (words = 0; words < total; words += step) {
+		seed = 7;
+		fresh_flash();
+		fill_bank(POOL_SIZE / 3, trigs);
+		storage_save();
+		for (i = 0; i < 4; i++) {
+			add_note(i % PATTERNS, i, trigs);
+		}
+		for (i = 0; i < PATTERNS; i++) {
+			storage_mark_all_dirty(i);
+		}
+		host_flash_cut(words);
+		storage_save();
+
+		power_cycle();
+		take(&loaded);
+		for (i = 0; i < PATTERNS; i++) {
+			for (j = 0; j < COLUMNS; j++) {
+				if (!same_column(&loaded, &before, i, j) && !same_column(&loaded, &after, i, j)) {
+					fprintf(stderr, "cut at word %d of %d: pattern %d column %d\n", words, total, i, j);
+					CHECK(0);
+				}
+			}
+		}
+		CHECK(!memcmp(loaded.length, before.length, sizeof(before.length)));
+		CHECK(loaded.song_length == before.song_length);
+
+		add_note(0, 0, trigs);									// Recovery leaves a log that still saves
+		take(&resaved);
+		storage_save();
+		power_cycle();
+		take(&loaded);
+		CHECK(!memcmp(&resaved, &loaded, sizeof(resaved)));
+	}
+}
+
+// Finds the word after the newest record header of slot, 0 if there is none
+static int find_record(int slot, int *page) {
+	int p, w, found = 0;
+	for (p = 0; p < FLASH_STORAGE_PAGES; p++) {
+		const unsigned int *words = flash_page(p);
+		for (w = 0; w < FLASH_PAGE_WORDS; w++) {
+			if (words[w] >> 24 == RECORD_MAGIC && (words[w] & 0xFFFF) == slot && ((words[w] >> 16) & 0xFF)) {
+				*page = p;
+				found = w;
+			}
+		}
+	}
+	return found;
+}
+
+static void test_bad_crc() {
+	struct bank old, loaded;
+	int page = 0, w;
+
+	seed = 11;
+	fresh_flash();
+	fill_bank(32, 0);
+	add_note(0, 5, 0);
+	storage_save();
+	take(&old);
+	add_note(0, 5, 0);
+	storage_save();
+
+	w = find_record(5, &page);
+	CHECK(w > 0);
+	host_flash_poke(page, w + 2, flash_page(page)[w + 2] ^ 0x100);	// A flipped bit in the first note
+	power_cycle();
+	take(&loaded);
+	CHECK(same_column(&loaded, &old, 0, 5));				// The copy before it wins
+
+	host_flash_poke(page, w + 1, ~flash_page(page)[w + 1]);	// A bad CRC word
+	power_cycle();
+	take(&loaded);
+	CHECK(same_column(&loaded, &old, 0, 5));
+}
+
+/*
+	Keeps one column changing while the rest of the bank stays put, so the
+	log goes round the pages many times and the untouched records have to
+	be carried forward each time their page comes up for erasing.
+*/
+static void test_wrap() {
+	struct bank saved, loaded;
+	int i, least, most;
+
+	seed = 3;
+	fresh_flash();
+	fill_bank(POOL_SIZE / 2, 1);
+	storage_save();
+	for (i = 0; i < 40 * FLASH_STORAGE_PAGES * FLASH_ROWS_PER_PAGE; i++) {
+		pattern_truncate(&patterns[PATTERNS - 1], COLUMNS - 1, 0);
+		add_note(PATTERNS - 1, COLUMNS - 1, 1);
+		add_note(PATTERNS - 1, COLUMNS - 1, 0);
+		storage_save();
+		if (i % 97 == 0) {
+			take(&saved);
+			power_cycle();
+			take(&loaded);
+			CHECK(!memcmp(&saved, &loaded, sizeof(saved)));
+		}
+	}
+	take(&saved);
+	power_cycle();
+	take(&loaded);
+	CHECK(!memcmp(&saved, &loaded, sizeof(saved)));
+
+	least = most = host_flash_erases(0);
+	for (i = 1; i < FLASH_STORAGE_PAGES; i++) {
+		if (host_flash_erases(i) < least) {
+			least = host_flash_erases(i);
+		}
+		if (host_flash_erases(i) > most) {
+			most = host_flash_erases(i);
+		}
+	}
+	CHECK(least > 10 && most - least <= least / 4);	// Worn evenly
+}
+
+int main() {
+	test_round_trip();
+	test_torn_save(0);
+	test_torn_save(1);
+	test_bad_crc();
+	test_wrap();
+	host_flash_close();
+	unlink(FLASH_FILE);
+	return test_done("storage");
+}
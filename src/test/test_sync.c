@@ -0,0 +1,127 @@
+/* test_sync.c
+   Clock slave mode against a simulated master. Timer2 is run a count at a
+   time with the core timer moving COUNTS_PER_TIMER2 counts per step, and
+   the master's clocks go to sync_realtime() as the receive interrupt would
+   pass them on. Timer2 must lock to the master's tempo, tick once per
+   clock from the start of playback even when the lock comes later, ride
+   out jitter, and let go when the clock stops. */
+
+#include <stdlib.h>
+#include <pic32mx.h>
+#include "init.h"
+#include "midi.h"
+#include "sync.h"
+#include "firmware.h"
+#include "test.h"
+
+#define COUNTS_PER_TIMER2 (CORE_TIMER_HZ / TIMER2_HZ)
+#define SECOND (CORE_TIMER_HZ / COUNTS_PER_TIMER2)		// Simulation steps
+
+static unsigned int seed = 9;
+static unsigned int now;									// Core timer
+static unsigned int next_clock;
+static unsigned int late;									// Jitter of the next clock
+static long ticks, clocks;
+
+static unsigned int next_random() {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static unsigned int clock_period(int bpm) {
+	return CORE_TIMER_HZ / 24 * 60 / bpm;
+}
+
+/* Runs for steps Timer2 counts, the master sending a clock every period
+   core timer counts, each up to jitter counts late, or none when period
+   is 0 */
+static void run(long steps, unsigned int period, unsigned int jitter) {
+	long i;
+	for (i = 0; i < steps; i++) {
+		now += COUNTS_PER_TIMER2;
+		host_core_timer = now;
+		if (period && (int) (now - next_clock - late) >= 0) {
+			sync_realtime(MIDI_CLOCK);
+			clocks++;
+			next_clock += period;
+			late = jitter ? next_random() % jitter : 0;
+		}
+		if (++TMR2 > PR2) {
+			TMR2 = 0;
+			timer2_isr();
+			ticks++;
+		}
+		sync_poll();
+	}
+}
+
+/* Starts playback at the pot tempo with the master's first clock a little
+   later */
+static void start(int pot_bpm, int master_bpm) {
+	PR2 = TIMER2_HZ * 60 / (pot_bpm * 24) - 1;
+	TMR2 = 0;
+	sync_realtime(MIDI_START);
+	play = 1;
+	sync_start();
+	ticks = clocks = 0;
+	next_clock = now + clock_period(master_bpm) / 3;
+	late = 0;
+}
+
+// Clocks and ticks counted over a stretch of the run
+static void follow(long steps, int bpm, unsigned int jitter, int *tick_change, int *clock_change) {
+	long t = ticks, c = clocks;
+	run(steps, clock_period(bpm), jitter);
+	*tick_change = ticks - t;
+	*clock_change = clocks - c;
+}
+
+static void test_lock_after_start() {
+	int dt, dc;
+	start(130, 100);
+	run(4 * SECOND, clock_period(100), 0);
+	CHECK(clock_locked);
+	CHECK(sync_tempo() == 100);
+	CHECK(labs(ticks - clocks) <= 1);				// The early ticks at 130 BPM were taken back
+	follow(4 * SECOND, 100, 0, &dt, &dc);
+	CHECK(abs(dt - dc) <= 1);
+	CHECK(labs(ticks - clocks) <= 1);
+}
+
+static void test_jitter() {
+	int dt, dc;
+	start(90, 137);
+	run(4 * SECOND, clock_period(137), 0);
+	follow(8 * SECOND, 137, 2 * CORE_TIMER_HZ / 1000, &dt, &dc);	// Up to 2 ms late
+	CHECK(clock_locked);
+	CHECK(abs(dt - dc) <= 1);
+	CHECK(labs(ticks - clocks) <= 1);
+	CHECK(abs(sync_tempo_tenths() - 1370) <= 5);
+}
+
+static void test_clock_stops() {
+	int dt, dc;
+	start(120, 120);
+	run(2 * SECOND, clock_period(120), 0);
+	CHECK(clock_locked);
+	run(SECOND, 0, 0);
+	CHECK(!clock_locked);
+
+	/* Playing on without a master for a while, a master coming later
+	   does not make the steps catch up on the clocks that never came */
+	run(10 * SECOND, 0, 0);
+	ticks = clocks = 0;
+	next_clock = now;
+	run(2 * SECOND, clock_period(120), 0);
+	CHECK(clock_locked);
+	follow(2 * SECOND, 120, 0, &dt, &dc);
+	CHECK(abs(dt - dc) <= 1);
+}
+
+int main() {
+	clock_out = 0;
+	test_lock_after_start();
+	test_jitter();
+	test_clock_stops();
+	return test_done("sync");
+}
@@ -0,0 +1,123 @@
+/* test_thru.c
+   MIDI thru on a simulated wire, a byte in and a byte out per byte time.
+   A thru message goes out whole between two sequenced messages, never
+   inside one, its last byte leaves a byte time after it came in when the
+   output is idle, and the filter remaps its channel and drops notes out
+   of range, also under running status. */
+
+#include <pic32mx.h>
+#include "midi.h"
+#include "firmware.h"
+#include "test.h"
+
+#define WIRE_BYTES 256
+
+static unsigned char out[WIRE_BYTES];
+static int out_time[WIRE_BYTES];						// Byte time each byte went out
+static int sent;
+static int now;
+
+// One byte time: in comes in when not -1, and the UART sends a byte if it has one
+static void byte_time(int in) {
+	if (in >= 0) {
+		host_midi_in(in);
+	}
+	U1TXREG = HOST_NO_BYTE;
+	midi_tx_isr();
+	if (U1TXREG != HOST_NO_BYTE && sent < WIRE_BYTES) {
+		out[sent] = U1TXREG;
+		out_time[sent++] = now;
+	}
+	now++;
+}
+
+// Sends bytes on the wire, returns the byte time of the last
+static int receive(const unsigned char *bytes, int n) {
+	int i;
+	for (i = 0; i < n; i++) {
+		byte_time(bytes[i]);
+	}
+	return now - 1;
+}
+
+static void drain() {
+	int i;
+	for (i = 0; i < WIRE_BYTES / 2; i++) {
+		byte_time(-1);
+	}
+}
+
+static void reset() {
+	drain();
+	sent = 0;
+}
+
+static void test_idle() {
+	static const unsigned char note[3] = {0x90, 60, 100};
+	int last;
+	reset();
+	last = receive(note, 3);
+	drain();
+	CHECK(sent == 3 && out[0] == 0x90 && out[1] == 60 && out[2] == 100);
+	CHECK(out_time[2] - last == 1);
+}
+
+static void test_merge() {
+	static const unsigned char note[3] = {0x90, 61, 90};
+	struct message m = {0x92, 40, 100, 1};
+	int i, last, thru = -1;
+
+	reset();
+	for (i = 0; i < 10; i++) {									// A column burst
+		m.note = 40 + i;
+		send_midi_message(m);
+	}
+	byte_time(-1);
+	last = receive(note, 3);
+	drain();
+
+	CHECK(sent == 33);
+	for (i = 0; i < sent; i += 3) {							// Whole messages only
+		CHECK(out[i] & 0x80);
+		CHECK(!(out[i + 1] & 0x80) && !(out[i + 2] & 0x80));
+		if (out[i] == 0x90) {
+			thru = i;
+		}
+	}
+	CHECK(thru > 0 && thru < 3 * 3);							// Ahead of most of the burst
+	CHECK(out[thru + 1] == 61 && out[thru + 2] == 90);
+	CHECK(out_time[thru + 2] - last <= 3);				// Waited for one message at most
+}
+
+static void test_filter() {
+	static const unsigned char notes[7] = {0x91, 60, 100, 40, 100, 70, 0};
+	thru_channel = 4;
+	thru_note_low = 48;
+	thru_note_high = 72;
+	reset();
+	receive(notes, 7);
+	drain();
+	CHECK(sent == 6);
+	CHECK(out[0] == 0x94 && out[1] == 60 && out[2] == 100);
+	CHECK(out[3] == 0x94 && out[4] == 70 && out[5] == 0);	// Status again, 40 left out
+	thru_channel = -1;
+	thru_note_low = 0;
+	thru_note_high = 127;
+
+	thru_enabled = 0;
+	reset();
+	receive(notes, 3);
+	drain();
+	CHECK(sent == 0);
+	thru_enabled = 1;
+}
+
+int main() {
+	thru_enabled = 1;
+	record = 0;
+	play = 0;
+	test_idle();
+	test_merge();
+	test_filter();
+	return test_done("thru");
+}
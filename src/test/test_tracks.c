@@ -0,0 +1,115 @@
+/* test_tracks.c
+   Tracks of their own lengths: eight tracks of co-prime lengths played
+   through play_step each wrap at their own length, tracks on the same
+   column are walked once, a restart from a song position places every
+   track, and a track shortened under its position wraps on the next
+   step. */
+
+#include <pic32mx.h>
+#include "midi.h"
+#include "track.h"
+#include "firmware.h"
+#include "test.h"
+
+#define STEPS 500
+
+static const int lengths[8] = {2, 3, 5, 7, 11, 13, 17, 0};	// Channel 8 follows the pattern
+
+// The channels whose note played on the next step
+static unsigned int step() {
+	unsigned char notes[ROWS];
+	unsigned int channels = 0;
+	int i, n = host_play_step(notes, ROWS);
+	for (i = 0; i < n; i++) {
+		channels |= 1 << (notes[i] - 60);
+	}
+	return channels;
+}
+
+// The channels that play on step s, counted from the start
+static unsigned int due(int s) {
+	unsigned int channels = 0;
+	int c;
+	for (c = 0; c < 8; c++) {
+		channels |= (s % (lengths[c] ? lengths[c] : 16) == 0) << c;
+	}
+	return channels;
+}
+
+static void setup() {
+	int c;
+	pattern_init();
+	pattern_set_length(current_pattern, 16);
+	for (c = 0; c < 8; c++) {
+		struct message m = {0x90 | c, 60 + c, 100, 1, 0, 1, 0};
+		pattern_set_track_length(current_pattern, c, lengths[c]);
+		pattern_append(current_pattern, 0, m);
+	}
+	channel_mask = 0xFFFF;
+	clock_out = 0;
+	PR2 = 3254;
+}
+
+static void test_wrap() {
+	unsigned short columns[TRACKS + 1], channels[TRACKS + 1];
+	int s, same = 1;
+
+	setup();
+	start_playback(1);
+	for (s = 0; s < STEPS; s++) {
+		same &= step() == due(s);
+	}
+	CHECK(same);
+	stop_playback();
+
+	start_playback(1);
+	step();
+	CHECK(track_groups(current_column, columns, channels) == 1);	// All on column 0
+	CHECK(channels[0] == 0xFFFF);
+	step();
+	step();
+	CHECK(track_groups(current_column, columns, channels) == 2);	// Length 2 back on 0
+	CHECK(columns[0] == 2 && columns[1] == 0 && channels[1] == 1);
+	step();
+	CHECK(track_groups(current_column, columns, channels) == 3);	// Length 3 on 0 too
+	CHECK(columns[0] == 3 && columns[1] == 1 && columns[2] == 0 && channels[2] == 2);
+	stop_playback();
+}
+
+static void test_song_position() {
+	int s, same = 1;
+	setup();
+	start_playback(1);
+	track_restart(current_pattern, 100);					// As a song position at step 100
+	current_column = 100 % 16 - 1;
+	for (s = 100; s < 100 + 3 * 17; s++) {
+		same &= step() == due(s);
+	}
+	CHECK(same);
+	stop_playback();
+}
+
+static void test_shorten() {
+	int s;
+	setup();
+	start_playback(1);
+	for (s = 0; s < 6; s++) {
+		step();													// Channel 4 is on its column 5 of 7
+	}
+	CHECK(track_column(3, current_column) == 5);
+	pattern_set_track_length(current_pattern, 3, 4);
+	CHECK(step() & (1 << 3));								// Past the end, so it wraps
+	CHECK(track_column(3, current_column) == 0);
+	for (s = 0; s < 3; s++) {
+		CHECK(!(step() & (1 << 3)));
+	}
+	CHECK(step() & (1 << 3));
+	stop_playback();
+}
+
+int main() {
+	test_wrap();
+	test_song_position();
+	test_shorten();
+	return test_done("tracks");
+}
@@ -0,0 +1,110 @@
+/* test_trig.c
+   Chances and loop conditions of stored notes: how often a note with a
+   chance plays over many loops, which loops a condition lets through, and
+   a fixed seed making playback from the top play the same notes again. */
+
+#include <stdlib.h>
+#include <pic32mx.h>
+#include "midi.h"
+#include "rng.h"
+#include "trig.h"
+#include "firmware.h"
+#include "test.h"
+
+#define TRIALS 16000
+
+// Times out of TRIALS a note recorded with chance plays
+static int plays(int chance) {
+	struct message m = {0x90, 60, 100, 1};
+	int i, count = 0;
+	trig_set_chance(chance);
+	m.skip = trig_record_skip;
+	for (i = 0; i < TRIALS; i++) {
+		count += trig_plays(m);
+	}
+	return count;
+}
+
+static void test_chance() {
+	rng_seed(99);
+	CHECK(plays(127) == TRIALS);
+	CHECK(plays(0) == 0);
+	CHECK(abs(plays(64) - TRIALS * 9 / 16) < TRIALS / 40);	// Skipped 7 sixteenths
+	CHECK(abs(plays(79) - TRIALS * 10 / 16) < TRIALS / 40);
+	CHECK(abs(plays(1) - TRIALS * 2 / 16) < TRIALS / 40);	// Rarely, but not never
+	trig_set_chance(127);
+}
+
+// Bits of the loops 1 to 16 after a restart that a note with condition plays on
+static unsigned int loops(int condition) {
+	struct message m = {0x90, 60, 100, 1};
+	unsigned int bits = 0;
+	int i;
+	trig_set_condition(condition);
+	m.condition = trig_record_condition;
+	trig_restart();
+	for (i = 0; i < 16; i++) {
+		trig_loop();
+		bits |= trig_plays(m) << i;
+	}
+	return bits;
+}
+
+static void test_condition() {
+	CHECK(loops(TRIG_ALWAYS) == 0xFFFF);
+	CHECK(loops(TRIG_FIRST) == 0x0001);
+	CHECK(loops(TRIG_NOT_FIRST) == 0xFFFE);
+	CHECK(loops(TRIG_EVERY | (2 - 1) << 3 | (2 - 1)) == 0xAAAA);	// Loop 2 of every 2
+	CHECK(loops(TRIG_EVERY | (3 - 1) << 3 | (1 - 1)) == 0x9249);	// Loop 1 of every 3
+	CHECK(loops(TRIG_EVERY | (8 - 1) << 3 | (8 - 1)) == 0x8080);
+	CHECK(loops(TRIG_EVERY | (3 - 1) << 3 | (4 - 1)) == 0xFFFF);	// No loop 4 of 3, plays always
+	trig_fill = 1;
+	CHECK(loops(TRIG_FILL) == 0xFFFF && loops(TRIG_NOT_FILL) == 0);
+	trig_fill = 0;
+	CHECK(loops(TRIG_FILL) == 0 && loops(TRIG_NOT_FILL) == 0xFFFF);
+	trig_set_condition(TRIG_ALWAYS);
+}
+
+// Bits of the 32 loops from the top that the half chance note of column 0 played on
+static unsigned int replay() {
+	unsigned char notes[ROWS];
+	unsigned int bits = 0;
+	int i;
+	start_playback(1);
+	for (i = 0; i < 32; i++) {
+		bits |= (host_play_step(notes, ROWS) == 1) << i;
+		host_play_step(notes, ROWS);
+	}
+	stop_playback();
+	return bits;
+}
+
+static void test_seed() {
+	struct message m = {0x90, 60, 100, 1, 0, CLOCKS_PER_STEP, 8};
+	unsigned int first;
+
+	pattern_init();
+	pattern_set_length(current_pattern, 2);
+	pattern_append(current_pattern, 0, m);
+	channel_mask = 0xFFFF;
+	clock_out = 0;
+	PR2 = 3254;
+
+	trig_set_seed(77);
+	first = replay();
+	CHECK(first != 0 && first != 0xFFFFFFFF);
+	CHECK(replay() == first);
+	rng_next();
+	CHECK(replay() == first);									// Whatever ran in between
+	trig_set_seed(78);
+	CHECK(replay() != first);
+	trig_set_seed(0);
+	CHECK(replay() != replay());								// Running on
+}
+
+int main() {
+	test_chance();
+	test_condition();
+	test_seed();
+	return test_done("trig");
+}
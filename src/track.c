@@ -0,0 +1,103 @@
+/* track.c
+   Step positions of tracks with their own length.
+
+   A track is the notes of one channel. Tracks without their own length
+   play the column of the pattern; the others keep their own position,
+   counted in the same steps but wrapping at their own length, so tracks
+   of co-prime lengths only line up again after the product of them.
+
+   Only the positions move each step, so a step costs one increment per
+   track, however long the tracks are. Tracks on the same column are
+   grouped, and play_column walks each column that is due once. */
+
+#include "track.h"
+
+static unsigned short own = 0;							// Channels with their own length
+static unsigned char position[TRACKS];				// Column playing of each of them
+
+// Columns played by the notes of channel before wrapping
+int track_length(struct pattern *p, int channel) {
+	return p->track_lengths[channel] ? p->track_lengths[channel] : p->length;
+}
+
+// Column playing on channel while the pattern plays column
+int track_column(int channel, int column) {
+	return (own & (1 << channel)) ? position[channel] : column;
+}
+
+/*
+	Places the tracks of p so that the next step plays step, counted from
+	the start of the pattern. Called when playback starts, on a song
+	position and when the pattern switches.
+*/
+void track_restart(struct pattern *p, int step) {
+	int channel;
+	own = 0;
+	for (channel = 0; channel < TRACKS; channel++) {
+		int length = p->track_lengths[channel];
+		if (length) {
+			own |= 1 << channel;
+			position[channel] = (step + length - 1) % length;
+		}
+	}
+}
+
+/*
+	Moves every track with its own length to its next column, column being
+	the one the pattern just moved to. A track that was just given its own
+	length starts where the pattern is.
+*/
+void track_step(struct pattern *p, int column) {
+	int channel;
+	for (channel = 0; channel < TRACKS; channel++) {
+		int length = p->track_lengths[channel];
+		unsigned short bit = 1 << channel;
+		if (!length) {
+			own &= ~bit;
+		} else if (!(own & bit)) {
+			own |= bit;
+			position[channel] = column % length;
+		} else if (++position[channel] >= length) {	// Compare, the length may just have shrunk
+			position[channel] = 0;
+		}
+	}
+}
+
+/*
+	Moves every track with its own length back a column, as the step notes
+	are entered on moves back while paused
+*/
+void track_step_back(struct pattern *p) {
+	int channel;
+	for (channel = 0; channel < TRACKS; channel++) {
+		int length = p->track_lengths[channel];
+		if (length && (own & (1 << channel))) {
+			position[channel] = (position[channel] + length - 1) % length;
+		}
+	}
+}
+
+/*
+	Fills columns with the columns due this step and channels with the
+	channels playing each of them, column being the one of the pattern.
+	Returns the number of columns, at most TRACKS + 1.
+*/
+int track_groups(int column, unsigned short *columns, unsigned short *channels) {
+	int count = 1;
+	int channel, i;
+	unsigned short pending;
+	columns[0] = column;
+	channels[0] = ~own;
+	for (channel = 0, pending = own; pending; channel++, pending >>= 1) {
+		if (pending & 1) {
+			for (i = 0; i < count && columns[i] != position[channel]; i++) {
+			}
+			if (i == count) {
+				columns[count] = position[channel];
+				channels[count++] = 0;
+			}
+			channels[i] |= 1 << channel;
+		}
+	}
+	return count;
+}
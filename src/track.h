@@ -0,0 +1,16 @@
+/* track.h
+   Step positions of tracks with their own length. */
+
+#ifndef TRACK_H
+#define TRACK_H
+
+#include "sequencer.h"
+
+int track_length(struct pattern *p, int channel);
+int track_column(int channel, int column);
+void track_restart(struct pattern *p, int step);
+void track_step(struct pattern *p, int column);
+void track_step_back(struct pattern *p);
+int track_groups(int column, unsigned short *columns, unsigned short *channels);
+
+#endif
@@ -0,0 +1,96 @@
+/* trig.c
+   Probabilities and loop conditions of stored notes.
+
+   A note can be left out some of the time: message.skip is the number of
+   sixteenths of its steps it is skipped, decided with a random number
+   each time, or TRIG_SKIP_ALL for never, and message.condition limits it
+   to some loops of the pattern. Both are 0 for a note that always plays,
+   which is all trig_plays tests for most notes.
+
+   The loop counters are advanced once per loop, so a condition is a
+   compare: loop_phase[n] is the loop number modulo n, kept without
+   dividing. With a fixed seed the random numbers start over whenever
+   playback starts from the top or the pattern switches, so a replay
+   plays the same notes. */
+
+#include "rng.h"
+#include "trig.h"
+
+#define EVERY_MAX 8
+
+int trig_fill = 0;
+unsigned char trig_record_skip = 0;
+unsigned char trig_record_condition = TRIG_ALWAYS;
+
+static unsigned int fixed_seed = 0;					// 0 lets the numbers run on
+static int first_loop = 1;
+static unsigned char loop_phase[EVERY_MAX + 1];	// Loop number modulo each n
+
+// Chance of notes recorded from now on, 0 never to 127 always
+void trig_set_chance(int value) {
+	int skip = (127 - value) >> 3;
+	trig_record_skip = (value == 0) ? TRIG_SKIP_ALL : (skip < TRIG_SKIP_ALL ? skip : TRIG_SKIP_ALL - 1);
+}
+
+// Condition of notes recorded from now on, anything unknown plays always
+void trig_set_condition(int value) {
+	int n = ((value >> 3) & 7) + 1;
+	if (value & TRIG_EVERY) {
+		trig_record_condition = (n >= 2 && (value & 7) < n) ? value : TRIG_ALWAYS;
+	} else {
+		trig_record_condition = (value <= TRIG_NOT_FILL) ? value : TRIG_ALWAYS;
+	}
+}
+
+// Seeds the probabilities at every start from the top, or never for 0
+void trig_set_seed(int seed) {
+	fixed_seed = seed;
+}
+
+// The next loop is the first, called when playback starts or the pattern switches
+void trig_restart() {
+	int n;
+	for (n = 2; n <= EVERY_MAX; n++) {
+		loop_phase[n] = n - 1;							// trig_loop takes it to 0
+	}
+	first_loop = -1;
+	if (fixed_seed) {
+		rng_seed(fixed_seed);
+	}
+}
+
+// Called as each loop of the pattern starts
+void trig_loop() {
+	int n;
+	for (n = 2; n <= EVERY_MAX; n++) {
+		loop_phase[n] = (loop_phase[n] == n - 1) ? 0 : loop_phase[n] + 1;
+	}
+	first_loop = (first_loop < 0);
+}
+
+// Returns 1 if a stored note should sound this time
+int trig_plays(struct message msg) {
+	if (!msg.skip && !msg.condition) {
+		return 1;
+	}
+	if (msg.skip && (msg.skip == TRIG_SKIP_ALL || (rng_next() & 15) < msg.skip)) {
+		return 0;
+	}
+	switch (msg.condition) {
+		case TRIG_ALWAYS:
+			return 1;
+		case TRIG_FIRST:
+			return first_loop;
+		case TRIG_NOT_FIRST:
+			return !first_loop;
+		case TRIG_FILL:
+			return trig_fill;
+		case TRIG_NOT_FILL:
+			return !trig_fill;
+	}
+	if (msg.condition & TRIG_EVERY) {
+		int n = ((msg.condition >> 3) & 7) + 1;
+		return n >= 2 && loop_phase[n] == (msg.condition & 7);
+	}
+	return 1;
+}
@@ -0,0 +1,30 @@
+/* trig.h
+   Probabilities and loop conditions of stored notes. */
+
+#ifndef TRIG_H
+#define TRIG_H
+
+#include "sequencer.h"
+
+/* Values of message.condition */
+#define TRIG_ALWAYS 0
+#define TRIG_FIRST 1							// The first loop after start or a pattern switch
+#define TRIG_NOT_FIRST 2
+#define TRIG_FILL 3							// While fill is on
+#define TRIG_NOT_FILL 4
+#define TRIG_EVERY 0x40						// | (n - 1) << 3 | (k - 1): loop k of every n, n 2 to 8
+
+#define TRIG_SKIP_ALL 15						// message.skip of a note that never plays
+
+extern int trig_fill;
+extern unsigned char trig_record_skip;			// Given to notes as they are recorded
+extern unsigned char trig_record_condition;
+
+void trig_set_chance(int value);
+void trig_set_condition(int value);
+void trig_set_seed(int seed);
+void trig_restart(void);
+void trig_loop(void);
+int trig_plays(struct message msg);
+
+#endif
@@ -0,0 +1,41 @@
+/* watchdog.c
+   Watchdog supervision of the main loop.
+
+   Every part of the main loop checks in once it has done the work that was
+   due. Input and display run on every pass and always check in; steps and
+   the tempo only check in when the clock has nothing more due, so a loop
+   that keeps falling behind the clock is caught as well. While paused
+   Timer2 stops and nothing comes due. The watchdog timer is only cleared
+   when all of them have checked in, so a part that hangs, a pass that
+   never ends or a loop that never catches up lets it reset the chip.
+   The tasks that had checked in are kept in diag_state, which survives
+   the reset, so the diagnostics report shows which one got stuck. The
+   timeout is set by the FWDTPS configuration bits and has to be longer
+   than a save to flash, a few page erases of some 20 ms each. */
+
+#include <pic32mx.h>
+#include "diag.h"
+#include "watchdog.h"
+
+#define WDT_ON 0x8000
+#define WDT_CLEAR 0x0001
+#define ALL_TASKS ((1 << WATCHDOG_TASKS) - 1)
+
+void watchdog_init() {
+	diag_state.watchdog_tasks = 0;
+	WDTCONSET = WDT_CLEAR;
+	WDTCONSET = WDT_ON;
+}
+
+/* For long operations that keep making progress, such as all notes off */
+void watchdog_clear() {
+	WDTCONSET = WDT_CLEAR;
+}
+
+void watchdog_checkin(enum watchdog_task task) {
+	diag_state.watchdog_tasks |= 1 << task;
+	if (diag_state.watchdog_tasks == ALL_TASKS) {
+		diag_state.watchdog_tasks = 0;
+		WDTCONSET = WDT_CLEAR;
+	}
+}
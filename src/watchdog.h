@@ -0,0 +1,19 @@
+/* watchdog.h
+   Watchdog supervision of the main loop. */
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+enum watchdog_task {
+	TASK_STEP,										// Step playback
+	TASK_INPUT,										// Buttons, switches and remote commands
+	TASK_TEMPO,										// Potentiometer and clock lock
+	TASK_DISPLAY,
+	WATCHDOG_TASKS
+};
+
+void watchdog_init(void);
+void watchdog_checkin(enum watchdog_task task);
+void watchdog_clear(void);
+
+#endif